@@ -0,0 +1,111 @@
+/* This file is part of the Michigan Computer Graphics rasterization workshop.
+ * Copyright (C) 2025  Aidan Rhys Donley
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "bounds.hpp"
+
+#include <algorithm>
+
+void BoundingBox::expand(const Vec4 &point)
+{
+    low = {std::min(low.x, point.x), std::min(low.y, point.y), std::min(low.z, point.z)};
+    high = {std::max(high.x, point.x), std::max(high.y, point.y), std::max(high.z, point.z)};
+}
+
+void BoundingBox::expand(const BoundingBox &box)
+{
+    if (box.empty())
+        return;
+    expand(box.low);
+    expand(box.high);
+}
+
+bool BoundingBox::intersects(const BoundingBox &box) const
+{
+    return low.x <= box.high.x && box.low.x <= high.x &&
+           low.y <= box.high.y && box.low.y <= high.y &&
+           low.z <= box.high.z && box.low.z <= high.z;
+}
+
+float BoundingBox::distance_squared(const Vec4 &point) const
+{
+    float dx = std::max({low.x - point.x, 0.0f, point.x - high.x});
+    float dy = std::max({low.y - point.y, 0.0f, point.y - high.y});
+    float dz = std::max({low.z - point.z, 0.0f, point.z - high.z});
+    return dx * dx + dy * dy + dz * dz;
+}
+
+BoundingBox transform(const Matrix4 &matrix, const BoundingBox &box)
+{
+    BoundingBox result;
+    if (box.empty())
+        return result;
+
+    for (int i = 0; i < 8; ++i)
+    {
+        Vec4 corner{
+            i & 1 ? box.high.x : box.low.x,
+            i & 2 ? box.high.y : box.low.y,
+            i & 4 ? box.high.z : box.low.z,
+        };
+        result.expand(matrix * corner);
+    }
+    return result;
+}
+
+Frustum::Frustum(const Matrix4 &m_clip)
+{
+    auto row = [&](size_t i)
+    { return Vec4(m_clip.at(i, 0), m_clip.at(i, 1), m_clip.at(i, 2), m_clip.at(i, 3)); };
+
+    Vec4 x = row(0), y = row(1), z = row(2), w = row(3);
+
+    // Same planes as the Sutherland-Hodgman clipper, bounding [-w, w] on all axes
+    planes = {w + x, w - x, w + y, w - y, w + z, w - z};
+
+    for (Vec4 &plane : planes)
+    {
+        float length = std::sqrt(plane.x * plane.x + plane.y * plane.y + plane.z * plane.z);
+        if (!almost_zero(length))
+            plane /= length;
+    }
+}
+
+bool Frustum::intersects(const BoundingSphere &sphere) const
+{
+    const Vec4 &c = sphere.center;
+    for (const Vec4 &plane : planes)
+    {
+        float distance = plane.x * c.x + plane.y * c.y + plane.z * c.z + plane.w;
+        if (distance < -sphere.radius)
+            return false;
+    }
+    return true;
+}
+
+bool Frustum::intersects(const BoundingBox &box) const
+{
+    for (const Vec4 &plane : planes)
+    {
+        // Only the corner furthest along the plane's normal needs to be checked
+        float x = plane.x > 0 ? box.high.x : box.low.x;
+        float y = plane.y > 0 ? box.high.y : box.low.y;
+        float z = plane.z > 0 ? box.high.z : box.low.z;
+        if (plane.x * x + plane.y * y + plane.z * z + plane.w < 0)
+            return false;
+    }
+    return true;
+}
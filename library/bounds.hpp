@@ -0,0 +1,104 @@
+/* This file is part of the Michigan Computer Graphics rasterization workshop.
+ * Copyright (C) 2025  Aidan Rhys Donley
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <array>
+
+#include "vectors.hpp"
+#include "matrix.hpp"
+
+/**
+ * A sphere used to conservatively bound a set of points.
+ */
+struct BoundingSphere
+{
+    Vec4 center;
+    float radius = 0;
+};
+
+/**
+ * An axis-aligned box used to conservatively bound a set of points.
+ * A default constructed box is empty and contains nothing.
+ */
+struct BoundingBox
+{
+    Vec4 low{Infinity, Infinity, Infinity};
+    Vec4 high{-Infinity, -Infinity, -Infinity};
+
+    // Only made of plain data, so bundles can store this as bytes
+    using plain_data = void;
+
+    bool empty() const { return low.x > high.x || low.y > high.y || low.z > high.z; }
+
+    Vec4 center() const { return (low + high) * 0.5f; }
+
+    /**
+     * Grows the box to contain the given point.
+     */
+    void expand(const Vec4 &point);
+
+    /**
+     * Grows the box to contain the given box.
+     */
+    void expand(const BoundingBox &box);
+
+    /**
+     * Returns whether the two boxes overlap.
+     */
+    bool intersects(const BoundingBox &box) const;
+
+    /**
+     * Returns the squared distance from a point to the closest point in the box.
+     */
+    float distance_squared(const Vec4 &point) const;
+};
+
+/**
+ * Transforms all eight corners of a box and bounds the result.
+ */
+BoundingBox transform(const Matrix4 &matrix, const BoundingBox &box);
+
+/**
+ * The six planes of a viewing volume.
+ */
+class Frustum
+{
+public:
+    /**
+     * Extracts the clipping planes from a matrix that transforms into clip space.
+     * The planes are expressed in the input space of the matrix, so passing
+     * `projection * view * model` gives planes in the object's local space.
+     * https://www.gamedevs.org/uploads/fast-extraction-viewing-frustum-planes-from-world-view-projection-matrix.pdf
+     */
+    Frustum(const Matrix4 &m_clip);
+
+    /**
+     * Returns false only if the sphere is completely outside of at least one plane.
+     */
+    bool intersects(const BoundingSphere &sphere) const;
+
+    /**
+     * Returns false only if the box is completely outside of at least one plane.
+     */
+    bool intersects(const BoundingBox &box) const;
+
+private:
+    // Each plane stores its normal in xyz and its offset in w. Points inside
+    // the frustum have a positive signed distance to every plane.
+    std::array<Vec4, 6> planes;
+};
@@ -0,0 +1,167 @@
+/* This file is part of the Michigan Computer Graphics rasterization workshop.
+ * Copyright (C) 2025  Aidan Rhys Donley
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "bvh.hpp"
+
+#include <algorithm>
+#include <numeric>
+
+void BVH::build(const std::vector<BoundingBox> &boxes)
+{
+    nodes.clear();
+    item_bounds = boxes;
+    items.resize(boxes.size());
+    std::iota(items.begin(), items.end(), 0);
+
+    if (!boxes.empty())
+        build_node(boxes, 0, static_cast<uint32_t>(boxes.size()));
+}
+
+uint32_t BVH::build_node(const std::vector<BoundingBox> &boxes, uint32_t begin, uint32_t end)
+{
+    auto index = static_cast<uint32_t>(nodes.size());
+    nodes.emplace_back();
+
+    BoundingBox bounds, centers;
+    for (uint32_t i = begin; i < end; ++i)
+    {
+        bounds.expand(boxes[items[i]]);
+        centers.expand(boxes[items[i]].center());
+    }
+    nodes[index].bounds = bounds;
+
+    if (end - begin <= max_leaf_size)
+    {
+        nodes[index].offset = begin;
+        nodes[index].count = end - begin;
+        return index;
+    }
+
+    // Split at the median along the longest axis of the item centers
+    Vec4 extent = centers.high - centers.low;
+    auto axis_of = [&](const BoundingBox &box)
+    {
+        Vec4 center = box.center();
+        if (extent.x >= extent.y && extent.x >= extent.z)
+            return center.x;
+        if (extent.y >= extent.z)
+            return center.y;
+        return center.z;
+    };
+
+    uint32_t middle = begin + (end - begin) / 2;
+    std::nth_element(items.begin() + begin, items.begin() + middle, items.begin() + end, [&](uint32_t a, uint32_t b)
+                     { return axis_of(boxes[a]) < axis_of(boxes[b]); });
+
+    build_node(boxes, begin, middle);
+    uint32_t second = build_node(boxes, middle, end);
+
+    nodes[index].offset = second;
+    nodes[index].count = 0;
+    return index;
+}
+
+void BVH::refit(const std::vector<BoundingBox> &boxes)
+{
+    item_bounds = boxes;
+
+    // Children are always stored after their parent, so walking backwards updates them first
+    for (size_t i = nodes.size(); i-- > 0;)
+    {
+        Node &node = nodes[i];
+        node.bounds = {};
+        if (node.is_leaf())
+        {
+            for (uint32_t j = node.offset; j < node.offset + node.count; ++j)
+                node.bounds.expand(boxes[items[j]]);
+        }
+        else
+        {
+            node.bounds.expand(nodes[i + 1].bounds);
+            node.bounds.expand(nodes[node.offset].bounds);
+        }
+    }
+}
+
+void BVH::traverse(const Frustum &frustum, const Vec4 &eye, const std::function<void(uint32_t)> &action) const
+{
+    if (nodes.empty())
+        return;
+
+    std::vector<uint32_t> stack{0};
+    std::vector<std::pair<float, uint32_t>> leaf;
+
+    while (!stack.empty())
+    {
+        uint32_t index = stack.back();
+        const Node &node = nodes[index];
+        stack.pop_back();
+
+        if (!frustum.intersects(node.bounds))
+            continue;
+
+        if (node.is_leaf())
+        {
+            // Sort the few items in the leaf by their distance as well
+            leaf.clear();
+            for (uint32_t j = node.offset; j < node.offset + node.count; ++j)
+                if (frustum.intersects(item_bounds[items[j]]))
+                    leaf.emplace_back(item_bounds[items[j]].distance_squared(eye), items[j]);
+
+            std::sort(leaf.begin(), leaf.end());
+            for (const auto &[distance, item] : leaf)
+                action(item);
+            continue;
+        }
+
+        // Push the further child first so that the nearer child is visited first
+        uint32_t first = index + 1, second = node.offset;
+        if (nodes[first].bounds.distance_squared(eye) < nodes[second].bounds.distance_squared(eye))
+            std::swap(first, second);
+        stack.push_back(first);
+        stack.push_back(second);
+    }
+}
+
+void BVH::query(const BoundingBox &box, const std::function<void(uint32_t)> &action) const
+{
+    if (nodes.empty())
+        return;
+
+    std::vector<uint32_t> stack{0};
+
+    while (!stack.empty())
+    {
+        uint32_t index = stack.back();
+        const Node &node = nodes[index];
+        stack.pop_back();
+
+        if (!node.bounds.intersects(box))
+            continue;
+
+        if (node.is_leaf())
+        {
+            for (uint32_t j = node.offset; j < node.offset + node.count; ++j)
+                if (item_bounds[items[j]].intersects(box))
+                    action(items[j]);
+            continue;
+        }
+
+        stack.push_back(index + 1);
+        stack.push_back(node.offset);
+    }
+}
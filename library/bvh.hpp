@@ -0,0 +1,76 @@
+/* This file is part of the Michigan Computer Graphics rasterization workshop.
+ * Copyright (C) 2025  Aidan Rhys Donley
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <vector>
+#include <functional>
+
+#include "bounds.hpp"
+
+/**
+ * A bounding volume hierarchy over a list of boxes.
+ *
+ * Items are referred to by their index in the list used to build the hierarchy.
+ * https://jacco.ompf2.com/2022/04/13/how-to-build-a-bvh-part-1-basics/
+ */
+class BVH
+{
+public:
+    static constexpr size_t max_leaf_size = 4;
+
+    /**
+     * Builds the hierarchy from scratch by splitting the boxes along their longest axis.
+     */
+    void build(const std::vector<BoundingBox> &boxes);
+
+    /**
+     * Updates the bounds of every node without changing the tree structure.
+     * This is cheaper than rebuilding but the tree gets looser as items move further.
+     * @param boxes The new bounds of each item, in the same order used to build the tree.
+     */
+    void refit(const std::vector<BoundingBox> &boxes);
+
+    /**
+     * Visits all items that may be inside of the frustum, ordered from nearest to furthest from the eye.
+     */
+    void traverse(const Frustum &frustum, const Vec4 &eye, const std::function<void(uint32_t)> &action) const;
+
+    /**
+     * Visits all items whose bounds overlap the given box.
+     */
+    void query(const BoundingBox &box, const std::function<void(uint32_t)> &action) const;
+
+    size_t size() const { return items.size(); }
+
+private:
+    struct Node
+    {
+        BoundingBox bounds;
+        // Leaves point to a range in `items`, other nodes store the index of their second child.
+        // The first child of a node is always stored directly after it.
+        uint32_t offset, count;
+
+        bool is_leaf() const { return count > 0; }
+    };
+
+    uint32_t build_node(const std::vector<BoundingBox> &boxes, uint32_t begin, uint32_t end);
+
+    std::vector<Node> nodes;
+    std::vector<uint32_t> items;
+    std::vector<BoundingBox> item_bounds;
+};
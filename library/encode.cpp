@@ -0,0 +1,653 @@
+/* This file is part of the Michigan Computer Graphics rasterization workshop.
+ * Copyright (C) 2025  Aidan Rhys Donley
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "encode.hpp"
+#include "library.hpp"
+
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <numeric>
+#include <stdexcept>
+#include <vector>
+
+static std::ofstream open_output(const std::string &path)
+{
+    std::ofstream file(path, std::ios::binary);
+    if (!file)
+        throw std::runtime_error("Could not open " + path + " for writing.");
+    return file;
+}
+
+static void check_output(const std::ofstream &file, const std::string &path)
+{
+    if (!file)
+        throw std::runtime_error("Error when writing " + path + ".");
+}
+
+static void push_big_endian(std::vector<uint8_t> &out, uint32_t value)
+{
+    out.push_back(static_cast<uint8_t>(value >> 24));
+    out.push_back(static_cast<uint8_t>(value >> 16));
+    out.push_back(static_cast<uint8_t>(value >> 8));
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+/**
+ * Writes a stream of bits starting from the least significant bit of each byte, as used by DEFLATE.
+ */
+class BitWriter
+{
+public:
+    BitWriter(std::vector<uint8_t> &out) : out(out) {}
+
+    void add(uint32_t bits, int count)
+    {
+        buffer |= bits << this->count;
+        this->count += count;
+        while (this->count >= 8)
+        {
+            out.push_back(static_cast<uint8_t>(buffer));
+            buffer >>= 8;
+            this->count -= 8;
+        }
+    }
+
+    // Huffman codes are packed starting from their most significant bit
+    void add_code(uint32_t code, int count)
+    {
+        uint32_t reversed = 0;
+        for (int i = 0; i < count; ++i)
+            reversed |= ((code >> i) & 1) << (count - 1 - i);
+        add(reversed, count);
+    }
+
+    // Pads with zeros to the next byte boundary
+    void align()
+    {
+        if (count > 0)
+            add(0, 8 - count);
+    }
+
+private:
+    std::vector<uint8_t> &out;
+    uint32_t buffer = 0;
+    int count = 0;
+};
+
+// Writes a literal or length symbol using the fixed Huffman codes of DEFLATE
+static void add_symbol(BitWriter &bits, uint32_t symbol)
+{
+    if (symbol < 144)
+        bits.add_code(0x30 + symbol, 8);
+    else if (symbol < 256)
+        bits.add_code(0x190 + symbol - 144, 9);
+    else if (symbol < 280)
+        bits.add_code(symbol - 256, 7);
+    else
+        bits.add_code(0xC0 + symbol - 280, 8);
+}
+
+static constexpr uint16_t length_base[] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static constexpr uint8_t length_extra[] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static constexpr uint16_t distance_base[] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+static constexpr uint8_t distance_extra[] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+static constexpr size_t window_size = 32768;
+static constexpr size_t min_match = 3, max_match = 258;
+static constexpr int hash_bits = 15;
+
+/**
+ * Compresses data into a single DEFLATE block using the fixed Huffman codes.
+ * Blocks that are not last end with an empty stored block, so that they finish on a byte
+ * boundary and can be followed directly by the next independently compressed block.
+ * https://www.rfc-editor.org/rfc/rfc1951
+ */
+static void deflate_block(const uint8_t *data, size_t size, int level, bool last, std::vector<uint8_t> &out)
+{
+    BitWriter bits(out);
+    bits.add(last ? 1 : 0, 1); // BFINAL
+    bits.add(1, 2);            // BTYPE = fixed Huffman codes
+
+    // Each level doubles the number of earlier positions that are compared against
+    size_t max_chain = size_t{1} << std::clamp(level, 1, 9);
+
+    std::vector<int32_t> head(size_t{1} << hash_bits, -1), previous(size, -1);
+    auto hash = [&](size_t i)
+    { return ((data[i] << 10) ^ (data[i + 1] << 5) ^ data[i + 2]) & ((1 << hash_bits) - 1); };
+    auto insert = [&](size_t i)
+    {
+        if (i + min_match > size)
+            return;
+        uint32_t h = hash(i);
+        previous[i] = head[h];
+        head[h] = static_cast<int32_t>(i);
+    };
+
+    size_t i = 0;
+    while (i < size)
+    {
+        size_t best_length = 0, best_distance = 0;
+        if (i + min_match <= size)
+        {
+            size_t limit = std::min(max_match, size - i);
+            int32_t candidate = head[hash(i)];
+            for (size_t chain = 0; candidate >= 0 && chain < max_chain && i - candidate <= window_size; ++chain)
+            {
+                size_t length = 0;
+                while (length < limit && data[candidate + length] == data[i + length])
+                    ++length;
+                if (length > best_length)
+                {
+                    best_length = length;
+                    best_distance = i - candidate;
+                    if (length == limit)
+                        break;
+                }
+                candidate = previous[candidate];
+            }
+        }
+
+        if (best_length >= min_match)
+        {
+            size_t code = 0;
+            while (code + 1 < std::size(length_base) && length_base[code + 1] <= best_length)
+                ++code;
+            add_symbol(bits, 257 + static_cast<uint32_t>(code));
+            bits.add(static_cast<uint32_t>(best_length - length_base[code]), length_extra[code]);
+
+            code = 0;
+            while (code + 1 < std::size(distance_base) && distance_base[code + 1] <= best_distance)
+                ++code;
+            bits.add_code(static_cast<uint32_t>(code), 5);
+            bits.add(static_cast<uint32_t>(best_distance - distance_base[code]), distance_extra[code]);
+
+            for (size_t end = i + best_length; i < end; ++i)
+                insert(i);
+        }
+        else
+        {
+            add_symbol(bits, data[i]);
+            insert(i);
+            ++i;
+        }
+    }
+
+    add_symbol(bits, 256); // end of block
+
+    if (!last)
+    {
+        // An empty stored block realigns the stream to a byte boundary
+        bits.add(0, 3);
+        bits.align();
+        out.insert(out.end(), {0x00, 0x00, 0xFF, 0xFF});
+    }
+    bits.align();
+}
+
+static constexpr uint32_t adler_modulus = 65521;
+
+static uint32_t adler32(const uint8_t *data, size_t size)
+{
+    uint32_t a = 1, b = 0;
+    while (size > 0)
+    {
+        // The sums cannot overflow within this many bytes
+        size_t block = std::min<size_t>(size, 5552);
+        for (size_t i = 0; i < block; ++i)
+        {
+            a += data[i];
+            b += a;
+        }
+        a %= adler_modulus;
+        b %= adler_modulus;
+        data += block;
+        size -= block;
+    }
+    return (b << 16) | a;
+}
+
+// Finds the checksum of two pieces of data joined together from the checksums of each piece
+static uint32_t adler32_combine(uint32_t first, uint32_t second, size_t second_size)
+{
+    uint64_t remainder = second_size % adler_modulus;
+    uint64_t a1 = first & 0xFFFF, b1 = first >> 16;
+    uint64_t a2 = second & 0xFFFF, b2 = second >> 16;
+
+    uint64_t a = (a1 + a2 + adler_modulus - 1) % adler_modulus;
+    uint64_t b = (b1 + b2 + remainder * a1 + adler_modulus - remainder) % adler_modulus;
+    return static_cast<uint32_t>((b << 16) | a);
+}
+
+static uint32_t crc32(const uint8_t *data, size_t size, uint32_t crc = 0)
+{
+    static const std::array<uint32_t, 256> table = []
+    {
+        std::array<uint32_t, 256> table;
+        for (uint32_t n = 0; n < 256; ++n)
+        {
+            uint32_t c = n;
+            for (int k = 0; k < 8; ++k)
+                c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            table[n] = c;
+        }
+        return table;
+    }();
+
+    crc = ~crc;
+    for (size_t i = 0; i < size; ++i)
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+static uint8_t paeth(int a, int b, int c)
+{
+    int p = a + b - c;
+    int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+    if (pa <= pb && pa <= pc)
+        return static_cast<uint8_t>(a);
+    return static_cast<uint8_t>(pb <= pc ? b : c);
+}
+
+// Writes the filter type and the filtered RGB bytes of a row. The row and the one above it may each have
+// 3 or 4 channels, and any alpha is skipped here instead of in a separate pass.
+static void filter_row(const uint8_t *row, uint32_t channels, const uint8_t *above, uint32_t above_channels, uint32_t width, int filter, uint8_t *out)
+{
+    out[0] = static_cast<uint8_t>(filter);
+    for (uint32_t x = 0; x < width; ++x)
+    {
+        for (uint32_t c = 0; c < 3; ++c)
+        {
+            int left = x > 0 ? row[(x - 1) * channels + c] : 0;
+            int up = above ? above[x * above_channels + c] : 0;
+            int corner = above && x > 0 ? above[(x - 1) * above_channels + c] : 0;
+
+            int predicted = 0;
+            switch (filter)
+            {
+                case 1: predicted = left; break;
+                case 2: predicted = up; break;
+                case 3: predicted = (left + up) / 2; break;
+                case 4: predicted = paeth(left, up, corner); break;
+            }
+            out[x * 3 + c + 1] = static_cast<uint8_t>(row[x * channels + c] - predicted);
+        }
+    }
+}
+
+PNGWriter::PNGWriter(const std::string &path, uint32_t width, uint32_t height, const PNGSettings &settings)
+    : path(path), file(open_output(path)), width(width), height(height), settings(settings)
+{
+    const uint8_t signature[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    file.write(reinterpret_cast<const char *>(signature), sizeof(signature));
+
+    std::vector<uint8_t> ihdr;
+    push_big_endian(ihdr, width);
+    push_big_endian(ihdr, height);
+    ihdr.insert(ihdr.end(), {8, 2, 0, 0, 0});
+    write_chunk("IHDR", ihdr);
+
+    // The zlib header starts the stream that the rows are compressed into
+    write_chunk("IDAT", {0x78, 0x9C});
+    check_output(file, path);
+}
+
+void PNGWriter::write_chunk(const char *type, const std::vector<uint8_t> &data)
+{
+    std::vector<uint8_t> chunk;
+    push_big_endian(chunk, static_cast<uint32_t>(data.size()));
+    chunk.insert(chunk.end(), type, type + 4);
+    chunk.insert(chunk.end(), data.begin(), data.end());
+    push_big_endian(chunk, crc32(chunk.data() + 4, chunk.size() - 4));
+    file.write(reinterpret_cast<const char *>(chunk.data()), chunk.size());
+}
+
+void PNGWriter::write_rows(const uint8_t *pixels, uint32_t channels, uint32_t rows, ptrdiff_t row_stride)
+{
+    if (channels != 3 && channels != 4)
+        throw std::runtime_error("PNG rows must have 3 or 4 channels.");
+    if (rows > height - rows_written)
+        throw std::runtime_error("Too many rows written to " + path + ".");
+    if (rows == 0)
+        return;
+
+    // The size of a filtered row in the file, which only holds RGB
+    size_t row_size = static_cast<size_t>(width) * 3;
+    uint32_t band_rows = std::max(settings.band_rows, 1u);
+    uint32_t bands = (rows + band_rows - 1) / band_rows;
+    bool last_rows = rows_written + rows == height;
+
+    struct Band
+    {
+        std::vector<uint8_t> compressed;
+        uint32_t checksum;
+        size_t size;
+    };
+    std::vector<Band> results(bands);
+
+    parallel_for(0, bands, [&](uint32_t band)
+    {
+        uint32_t begin = band * band_rows, end = std::min(begin + band_rows, rows);
+        std::vector<uint8_t> filtered((end - begin) * (row_size + 1));
+        std::vector<uint8_t> candidate(row_size + 1);
+
+        for (uint32_t y = begin; y < end; ++y)
+        {
+            // The first row is filtered against the last row of the previous call
+            const uint8_t *row = pixels + y * row_stride;
+            const uint8_t *above = y > 0 ? row - row_stride : (previous_row.empty() ? nullptr : previous_row.data());
+            uint32_t above_channels = y > 0 ? channels : previous_channels;
+            uint8_t *out = &filtered[(y - begin) * (row_size + 1)];
+
+            if (settings.filter >= 0)
+            {
+                filter_row(row, channels, above, above_channels, width, std::min(settings.filter, 4), out);
+                continue;
+            }
+
+            // Pick the filter with the smallest sum of absolute differences, the usual heuristic for compressibility
+            uint64_t best = UINT64_MAX;
+            for (int filter = 0; filter <= 4; ++filter)
+            {
+                filter_row(row, channels, above, above_channels, width, filter, candidate.data());
+                uint64_t sum = 0;
+                for (size_t i = 1; i <= row_size; ++i)
+                    sum += std::abs(static_cast<int8_t>(candidate[i]));
+                if (sum < best)
+                {
+                    best = sum;
+                    std::memcpy(out, candidate.data(), row_size + 1);
+                }
+            }
+        }
+
+        Band &result = results[band];
+        deflate_block(filtered.data(), filtered.size(), settings.level, last_rows && band + 1 == bands, result.compressed);
+        result.checksum = adler32(filtered.data(), filtered.size());
+        result.size = filtered.size();
+    }, false);
+
+    // Join the bands onto the zlib stream
+    std::vector<uint8_t> idat;
+    for (const Band &band : results)
+    {
+        idat.insert(idat.end(), band.compressed.begin(), band.compressed.end());
+        checksum = adler32_combine(checksum, band.checksum, band.size);
+    }
+    write_chunk("IDAT", idat);
+    check_output(file, path);
+
+    const uint8_t *last = pixels + static_cast<ptrdiff_t>(rows - 1) * row_stride;
+    previous_row.assign(last, last + static_cast<size_t>(width) * channels);
+    previous_channels = channels;
+    rows_written += rows;
+}
+
+void PNGWriter::finish()
+{
+    if (rows_written != height)
+        throw std::runtime_error("Not every row was written to " + path + ".");
+
+    std::vector<uint8_t> idat;
+    if (height == 0)
+    {
+        // An image without rows still needs a final block
+        BitWriter bits(idat);
+        bits.add(1, 1);
+        bits.add(1, 2);
+        add_symbol(bits, 256);
+        bits.align();
+    }
+    push_big_endian(idat, checksum);
+    write_chunk("IDAT", idat);
+    write_chunk("IEND", {});
+
+    file.close();
+    check_output(file, path);
+}
+
+void write_png(const std::string &path, uint32_t width, uint32_t height, uint32_t channels, const uint8_t *pixels, ptrdiff_t row_stride, const PNGSettings &settings)
+{
+    PNGWriter writer(path, width, height, settings);
+    writer.write_rows(pixels, channels, height, row_stride);
+    writer.finish();
+}
+
+void write_ppm(const std::string &path, uint32_t width, uint32_t height, uint32_t channels, const uint8_t *pixels, ptrdiff_t row_stride)
+{
+    std::ofstream file = open_output(path);
+    file << "P6\n" << width << " " << height << "\n255\n";
+
+    std::vector<uint8_t> row(static_cast<size_t>(width) * 3);
+    for (uint32_t y = 0; y < height; ++y)
+    {
+        const uint8_t *source = pixels + y * row_stride;
+        if (channels == 3)
+        {
+            file.write(reinterpret_cast<const char *>(source), row.size());
+            continue;
+        }
+        for (uint32_t x = 0; x < width; ++x)
+            std::memcpy(&row[x * 3], source + x * channels, 3);
+        file.write(reinterpret_cast<const char *>(row.data()), row.size());
+    }
+    check_output(file, path);
+}
+
+void write_qoi(const std::string &path, uint32_t width, uint32_t height, uint32_t channels, const uint8_t *pixels, ptrdiff_t row_stride)
+{
+    std::vector<uint8_t> out = {'q', 'o', 'i', 'f'};
+    push_big_endian(out, width);
+    push_big_endian(out, height);
+    out.push_back(3);
+    out.push_back(0); // sRGB with linear alpha
+
+    struct Pixel
+    {
+        uint8_t r, g, b, a;
+        bool operator==(const Pixel &) const = default;
+    };
+    std::array<Pixel, 64> seen{};
+    Pixel previous{0, 0, 0, 255};
+    uint32_t run = 0;
+
+    for (uint32_t y = 0; y < height; ++y)
+    {
+        const uint8_t *row = pixels + y * row_stride;
+        for (uint32_t x = 0; x < width; ++x)
+        {
+            const uint8_t *source = row + x * channels;
+            Pixel pixel{source[0], source[1], source[2], 255};
+
+            if (pixel == previous)
+            {
+                if (++run == 62)
+                {
+                    out.push_back(static_cast<uint8_t>(0xC0 | (run - 1)));
+                    run = 0;
+                }
+                continue;
+            }
+            if (run > 0)
+            {
+                out.push_back(static_cast<uint8_t>(0xC0 | (run - 1)));
+                run = 0;
+            }
+
+            uint32_t index = (pixel.r * 3 + pixel.g * 5 + pixel.b * 7 + pixel.a * 11) % 64;
+            if (seen[index] == pixel)
+            {
+                out.push_back(static_cast<uint8_t>(index));
+            }
+            else
+            {
+                seen[index] = pixel;
+
+                int dr = static_cast<int8_t>(pixel.r - previous.r);
+                int dg = static_cast<int8_t>(pixel.g - previous.g);
+                int db = static_cast<int8_t>(pixel.b - previous.b);
+                int dr_dg = dr - dg, db_dg = db - dg;
+
+                if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1)
+                    out.push_back(static_cast<uint8_t>(0x40 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2)));
+                else if (dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 && db_dg >= -8 && db_dg <= 7)
+                    out.insert(out.end(), {static_cast<uint8_t>(0x80 | (dg + 32)), static_cast<uint8_t>((dr_dg + 8) << 4 | (db_dg + 8))});
+                else
+                    out.insert(out.end(), {0xFE, pixel.r, pixel.g, pixel.b});
+            }
+            previous = pixel;
+        }
+    }
+    if (run > 0)
+        out.push_back(static_cast<uint8_t>(0xC0 | (run - 1)));
+
+    out.insert(out.end(), {0, 0, 0, 0, 0, 0, 0, 1});
+
+    std::ofstream file = open_output(path);
+    file.write(reinterpret_cast<const char *>(out.data()), out.size());
+    check_output(file, path);
+}
+
+void write_pfm(const std::string &path, uint32_t width, uint32_t height, const float *pixels, ptrdiff_t row_stride)
+{
+    std::ofstream file = open_output(path);
+    // A negative scale marks the floats as little endian
+    file << "PF\n" << width << " " << height << "\n-1.0\n";
+    for (uint32_t y = 0; y < height; ++y)
+        file.write(reinterpret_cast<const char *>(pixels + y * row_stride), static_cast<std::streamsize>(width) * 3 * sizeof(float));
+    check_output(file, path);
+}
+
+// Splits a row of interleaved pixels into red, green and blue rows, so the conversion below
+// only reads contiguous bytes.
+template <uint32_t Channels>
+static void split_row(const uint8_t *row, uint32_t width, uint8_t *red, uint8_t *green, uint8_t *blue)
+{
+    // A 64 bit index keeps the addresses affine, which the vectorizer needs for the strided loads
+    for (size_t x = 0; x < width; ++x)
+    {
+        red[x] = row[x * Channels];
+        green[x] = row[x * Channels + 1];
+        blue[x] = row[x * Channels + 2];
+    }
+}
+
+// Converts a split row to luma, using the BT.601 studio range coefficients in fixed point.
+// https://en.wikipedia.org/wiki/YCbCr#ITU-R_BT.601_conversion
+static void convert_luma(const uint8_t *red, const uint8_t *green, const uint8_t *blue, uint32_t width, uint8_t *luma)
+{
+    // The weighted sum stays below 2^16, so it fits in 16 bit lanes
+    for (uint32_t x = 0; x < width; ++x)
+        luma[x] = static_cast<uint8_t>(((66 * red[x] + 129 * green[x] + 25 * blue[x] + 128) >> 8) + 16);
+}
+
+// Sums each 2x2 block of a channel from two split rows
+static void sum_blocks(const uint8_t *top, const uint8_t *bottom, uint32_t pairs, uint16_t *sums)
+{
+    for (uint32_t x = 0; x < pairs; ++x)
+        sums[x] = static_cast<uint16_t>(top[2 * x] + top[2 * x + 1] + bottom[2 * x] + bottom[2 * x + 1]);
+}
+
+// Converts block sums to chroma. The sums are four samples, so the shifts are two bits larger.
+static void convert_chroma(const uint16_t *red, const uint16_t *green, const uint16_t *blue, uint32_t pairs, uint8_t *cb, uint8_t *cr)
+{
+    for (uint32_t x = 0; x < pairs; ++x)
+    {
+        int r = red[x], g = green[x], b = blue[x];
+        cb[x] = static_cast<uint8_t>(((-38 * r - 74 * g + 112 * b + 512) >> 10) + 128);
+        cr[x] = static_cast<uint8_t>(((112 * r - 94 * g - 18 * b + 512) >> 10) + 128);
+    }
+}
+
+Y4MWriter::Y4MWriter(const std::string &path, uint32_t width, uint32_t height, float frame_rate)
+    : path(path), out(&std::cout), width(width), height(height)
+{
+    if (path != "-")
+    {
+        file = open_output(path);
+        out = &file;
+    }
+
+    // The frame rate is stored as a fraction
+    uint32_t numerator = static_cast<uint32_t>(std::lround(frame_rate * 1000.0f)), denominator = 1000;
+    uint32_t divisor = std::gcd(numerator, denominator);
+    if (divisor > 0)
+    {
+        numerator /= divisor;
+        denominator /= divisor;
+    }
+
+    *out << "YUV4MPEG2 W" << width << " H" << height << " F" << numerator << ":" << denominator << " Ip A1:1 C420jpeg\n";
+
+    size_t luma = static_cast<size_t>(width) * height;
+    size_t chroma = static_cast<size_t>((width + 1) / 2) * ((height + 1) / 2);
+    frame.resize(luma + chroma * 2);
+    planes.resize(static_cast<size_t>(width) * ((height + 1) / 2) * 6);
+    sums.resize(chroma * 3);
+}
+
+void Y4MWriter::write_frame(const uint8_t *pixels, uint32_t channels, ptrdiff_t row_stride)
+{
+    size_t chroma_width = (width + 1) / 2, chroma_height = (height + 1) / 2;
+    uint8_t *luma = frame.data();
+    uint8_t *cb = luma + static_cast<size_t>(width) * height;
+    uint8_t *cr = cb + chroma_width * chroma_height;
+
+    parallel_for(0, static_cast<uint32_t>(chroma_height), [&](uint32_t row)
+    {
+        // Scratch space for the split rows and block sums of this row pair
+        uint8_t *split = planes.data() + static_cast<size_t>(row) * width * 6;
+        uint16_t *block_sums = sums.data() + row * chroma_width * 3;
+
+        // The last row of an odd height is repeated to fill its block
+        uint32_t y = row * 2;
+        bool has_bottom = y + 1 < height;
+        for (uint32_t i = 0; i < (has_bottom ? 2u : 1u); ++i)
+        {
+            const uint8_t *source = pixels + (y + i) * row_stride;
+            uint8_t *red = split + i * width * 3, *green = red + width, *blue = green + width;
+            if (channels == 4)
+                split_row<4>(source, width, red, green, blue);
+            else
+                split_row<3>(source, width, red, green, blue);
+            convert_luma(red, green, blue, width, luma + static_cast<size_t>(y + i) * width);
+        }
+        const uint8_t *top = split, *bottom = has_bottom ? split + width * 3 : split;
+
+        uint32_t pairs = width / 2;
+        for (uint32_t c = 0; c < 3; ++c)
+        {
+            const uint8_t *a = top + c * width, *b = bottom + c * width;
+            uint16_t *sum = block_sums + c * chroma_width;
+            sum_blocks(a, b, pairs, sum);
+
+            // The last column of an odd width is repeated to fill its block
+            if (width % 2 != 0)
+                sum[pairs] = static_cast<uint16_t>(2 * (a[width - 1] + b[width - 1]));
+        }
+        convert_chroma(block_sums, block_sums + chroma_width, block_sums + chroma_width * 2, static_cast<uint32_t>(chroma_width),
+                       cb + row * chroma_width, cr + row * chroma_width);
+    }, false);
+
+    *out << "FRAME\n";
+    out->write(reinterpret_cast<const char *>(frame.data()), frame.size());
+    out->flush();
+    if (!*out)
+        throw std::runtime_error("Error when writing " + path + ".");
+}
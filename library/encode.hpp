@@ -0,0 +1,155 @@
+/* This file is part of the Michigan Computer Graphics rasterization workshop.
+ * Copyright (C) 2025  Aidan Rhys Donley
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <vector>
+
+/**
+ * Settings for the PNG encoder.
+ */
+struct PNGSettings
+{
+    // How hard to search for repeated bytes, from 1 (fastest) to 9 (smallest files)
+    int level = 6;
+    // Forces every row to use one filter from 0 (none) to 4 (Paeth), or picks the best filter for each row if -1
+    int filter = -1;
+    // The number of rows in each band. Bands are compressed independently on separate threads.
+    uint32_t band_rows = 32;
+};
+
+/**
+ * Writes 8-bit pixels as an RGB PNG file, compressing bands of rows in parallel. Alpha is dropped.
+ * Each band is compressed on its own and the results are joined into one zlib stream,
+ * which only costs a few bytes and a restart of the match window per band.
+ * https://www.w3.org/TR/png/
+ * @param pixels The first pixel of the top row, with the channels of each pixel stored next to each other.
+ * @param row_stride The number of bytes from one row to the next, which is negative for images stored bottom up.
+ * @param channels Either 3 for RGB or 4 for RGBA.
+ */
+void write_png(const std::string &path, uint32_t width, uint32_t height, uint32_t channels, const uint8_t *pixels, ptrdiff_t row_stride, const PNGSettings &settings = {});
+
+/**
+ * Writes a PNG file a few rows at a time, so images too large to keep in memory can be saved as they are rendered.
+ * Each call compresses its rows in parallel bands in the same way as `write_png`.
+ */
+class PNGWriter
+{
+public:
+    /**
+     * Creates the file and writes its header.
+     */
+    PNGWriter(const std::string &path, uint32_t width, uint32_t height, const PNGSettings &settings = {});
+
+    PNGWriter(const PNGWriter &) = delete;
+    PNGWriter &operator=(const PNGWriter &) = delete;
+
+    /**
+     * Compresses and writes the next rows of the image, continuing from the top.
+     * @param pixels The first pixel of the topmost of the rows, in the same layout as `write_png`.
+     * @param channels Either 3 for RGB or 4 for RGBA, which may change between calls.
+     */
+    void write_rows(const uint8_t *pixels, uint32_t channels, uint32_t rows, ptrdiff_t row_stride);
+
+    /**
+     * Ends the file, which must be called after every row has been written.
+     */
+    void finish();
+
+    uint32_t get_width() const { return width; }
+    uint32_t get_height() const { return height; }
+
+private:
+    void write_chunk(const char *type, const std::vector<uint8_t> &data);
+
+    std::string path;
+    std::ofstream file;
+    uint32_t width, height;
+    PNGSettings settings;
+
+    uint32_t rows_written = 0;
+    // The Adler-32 checksum of all filtered rows so far
+    uint32_t checksum = 1;
+    // The last row written, which the next row is filtered against
+    std::vector<uint8_t> previous_row;
+    uint32_t previous_channels = 3;
+};
+
+/**
+ * Writes 8-bit pixels as a binary PPM file, which stores them without any encoding. Alpha is dropped.
+ * https://netpbm.sourceforge.net/doc/ppm.html
+ */
+void write_ppm(const std::string &path, uint32_t width, uint32_t height, uint32_t channels, const uint8_t *pixels, ptrdiff_t row_stride);
+
+/**
+ * Writes 8-bit pixels as an RGB QOI file, a simple lossless format that encodes much faster than PNG. Alpha is dropped.
+ * https://qoiformat.org/qoi-specification.pdf
+ */
+void write_qoi(const std::string &path, uint32_t width, uint32_t height, uint32_t channels, const uint8_t *pixels, ptrdiff_t row_stride);
+
+/**
+ * Writes linear floating point RGB pixels as a PFM file, which keeps values outside of [0, 1].
+ * PFM stores its rows from the bottom up, so the first row passed here is the bottom of the image.
+ * https://www.pauldebevec.com/Research/HDR/PFM/
+ * @param row_stride The number of floats from one row to the next.
+ */
+void write_pfm(const std::string &path, uint32_t width, uint32_t height, const float *pixels, ptrdiff_t row_stride);
+
+/**
+ * Streams frames as an uncompressed YUV4MPEG2 video, which video encoders such as ffmpeg can read
+ * directly from a pipe. Pixels are converted to 8-bit BT.601 YCbCr with 4:2:0 chroma subsampling.
+ * https://wiki.multimedia.cx/index.php/YUV4MPEG2
+ */
+class Y4MWriter
+{
+public:
+    /**
+     * Opens the stream and writes its header.
+     * @param path A file or named pipe to write to, or "-" for standard output.
+     */
+    Y4MWriter(const std::string &path, uint32_t width, uint32_t height, float frame_rate);
+
+    Y4MWriter(const Y4MWriter &) = delete;
+    Y4MWriter &operator=(const Y4MWriter &) = delete;
+
+    /**
+     * Converts and writes one frame, which must have the size given to the constructor.
+     * @param pixels The first pixel of the top row, in the same layout as `write_png`.
+     */
+    void write_frame(const uint8_t *pixels, uint32_t channels, ptrdiff_t row_stride);
+
+    uint32_t get_width() const { return width; }
+    uint32_t get_height() const { return height; }
+
+private:
+    std::string path;
+    std::ofstream file;
+    std::ostream *out;
+
+    uint32_t width, height;
+
+    // The three planes of a frame, reused between frames
+    std::vector<uint8_t> frame;
+
+    // Each row pair split into red, green and blue rows, and the sums of its 2x2 blocks
+    std::vector<uint8_t> planes;
+    std::vector<uint16_t> sums;
+};
@@ -1,245 +1,747 @@
-/* This file is part of the Michigan Computer Graphics rasterization workshop.
- * Copyright (C) 2025  Aidan Rhys Donley
- *
- * This program is free software: you can redistribute it and/or modify
- * it under the terms of the GNU General Public License as published by
- * the Free Software Foundation, either version 3 of the License, or
- * (at your option) any later version.
- *
- * This program is distributed in the hope that it will be useful,
- * but WITHOUT ANY WARRANTY; without even the implied warranty of
- * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
- * GNU General Public License for more details.
- *
- * You should have received a copy of the GNU General Public License
- * along with this program.  If not, see <https://www.gnu.org/licenses/>.
- */
-
-#include "library.hpp"
-
-#define STB_IMAGE_IMPLEMENTATION
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-
-#include "../thirdparty/stb/stb_image.h"
-#include "../thirdparty/stb/stb_image_write.h"
-
-#include <algorithm>
-#include <atomic>
-#include <iostream>
-#include <random>
-#include <stdexcept>
-#include <thread>
-#include <vector>
-
-using Random = std::default_random_engine;
-thread_local std::unique_ptr<Random> thread_random;
-
-Color &Color::operator=(const Color &other)
-{
-    if (this == &other)
-        return *this;
-    r = other.r;
-    g = other.g;
-    b = other.b;
-    return *this;
-}
-
-Color &Color::operator+=(const Color &rhs)
-{
-    r += rhs.r;
-    g += rhs.g;
-    b += rhs.b;
-    return *this;
-}
-
-Color &Color::operator-=(const Color &rhs)
-{
-    r -= rhs.r;
-    g -= rhs.g;
-    b -= rhs.b;
-    return *this;
-}
-
-Color &Color::operator*=(const Color &rhs)
-{
-    r *= rhs.r;
-    g *= rhs.g;
-    b *= rhs.b;
-    return *this;
-}
-
-Color &Color::operator*=(const float rhs)
-{
-    r *= rhs;
-    g *= rhs;
-    b *= rhs;
-    return *this;
-}
-
-Color operator+(Color lhs, const Color &rhs) { return (lhs += rhs); }
-Color operator-(Color lhs, const Color &rhs) { return (lhs -= rhs); }
-Color operator*(Color lhs, const Color &rhs) { return (lhs *= rhs); }
-Color operator*(Color lhs, const float rhs) { return (lhs *= rhs); }
-
-Color Image::get_pixel(float x, float y) const
-{
-    return pixels[get_index(
-        static_cast<uint32_t>(x * width),
-        static_cast<uint32_t>(y * width)
-    )];
-}
-
-void Image::write_file(const std::string &path) const
-{
-    std::vector<uint8_t> data;
-    data.reserve(width * height * 3);
-
-    auto convert_single = [](float value)
-    {
-        // Gamma correction and clamp
-        float corrected = std::sqrt(std::max(0.0f, std::min(value, 1.0f)));
-        return static_cast<uint8_t>(corrected * std::numeric_limits<uint8_t>::max());
-    };
-
-    for (uint32_t y = 0; y < height; ++y)
-    {
-        for (uint32_t x = 0; x < width; ++x)
-        {
-            auto &pixel = pixels[y * width + x];
-            data.push_back(convert_single(pixel.r));
-            data.push_back(convert_single(pixel.g));
-            data.push_back(convert_single(pixel.b));
-        }
-    }
-
-    auto casted_width = static_cast<int>(width);
-    auto casted_height = static_cast<int>(height);
-    int result = stbi_write_png(path.c_str(), casted_width, casted_height, 3, data.data(), 0);
-    if (result == 0)
-        throw std::runtime_error("Error in STB library when outputting image.");
-}
-
-void Image::load_file(const std::string &path)
-{
-    int w, h, n;
-    int result = stbi_info(path.c_str(), &w, &h, &n);
-    if (result == 0)
-        throw std::runtime_error("Error in STB library when reading image.");
-
-    width = static_cast<uint32_t>(w);
-    height = static_cast<uint32_t>(h);
-    pixels.reserve(width * height);
-
-    // input between [0, 255]
-    auto convert_single = [](int value)
-    {
-        float corrected = value / 255.0f;
-        return corrected * corrected; // Gamma correction
-    };
-
-    uint8_t *data = stbi_load(path.c_str(), &w, &h, &n, 3);
-    for (uint32_t y = 0; y < height; ++y)
-    {
-        for (uint32_t x = 0; x < width; ++x)
-        {
-            size_t index = y * width + x;
-            auto &pixel = pixels[index];
-            pixel.r = convert_single(data[index * 3 + 0]);
-            pixel.g = convert_single(data[index * 3 + 1]);
-            pixel.b = convert_single(data[index * 3 + 2]);
-        }
-    }
-}
-
-Image DepthBuffer::get_image() const
-{
-    Image image{width, height};
-    for (uint32_t u = 0; u < width; ++u)
-        for (uint32_t v = 0; v < height; ++v)
-            image.set_pixel(u, v, Color{at(u, v)});
-    return image;
-}
-
-static Random *make_random_engine(uint32_t seed)
-{
-    auto random = std::make_unique<Random>(seed);
-    Random *result = random.get();
-    thread_random = std::move(random);
-    return result;
-}
-
-float random_float()
-{
-    Random *random = thread_random.get();
-    if (random == nullptr)
-        random = make_random_engine(0);
-    std::uniform_real_distribution<float> distribution;
-    return distribution(*random);
-}
-
-void parallel_for(uint32_t begin, uint32_t end, const std::function<void(uint32_t)> &action, bool show_progress)
-{
-    auto print_done = []()
-    { std::printf("\r       \rdone\n"); };
-
-    if (end == begin)
-    {
-        if (show_progress)
-            print_done();
-        return;
-    }
-
-    if (end < begin)
-        std::swap(begin, end);
-
-    uint32_t workers = std::thread::hardware_concurrency();
-    workers = std::min(std::max(workers, 1U), end - begin);
-
-    std::vector<std::thread> threads;
-    std::atomic<uint32_t> current = begin;
-
-    for (uint32_t i = 0; i < workers; ++i)
-    {
-        auto entry = [i, end, &current, &action]()
-        {
-            make_random_engine(i);
-
-            while (true)
-            {
-                uint32_t index = current++;
-                if (index >= end)
-                    break;
-                action(index);
-            }
-        };
-
-        auto entry_print = [begin, end, &current, &action]()
-        {
-            make_random_engine(0);
-
-            while (true)
-            {
-                uint32_t index = current++;
-                if (index >= end)
-                    break;
-
-                uint32_t done = index - begin;
-                uint32_t total = end - begin;
-                std::printf("\r%5.2f %%", static_cast<float>(done) / total * 100.0f);
-                std::cout << std::flush;
-
-                action(index);
-            }
-        };
-
-        if (i > 0 || not show_progress)
-            threads.emplace_back(entry);
-        else
-            threads.emplace_back(entry_print);
-    }
-
-    for (auto &thread : threads)
-        thread.join();
-    if (show_progress)
-        print_done();
-}
+/* This file is part of the Michigan Computer Graphics rasterization workshop.
+ * Copyright (C) 2025  Aidan Rhys Donley
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "library.hpp"
+
+#define STB_IMAGE_IMPLEMENTATION
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+
+#include "../thirdparty/stb/stb_image.h"
+#include "../thirdparty/stb/stb_image_write.h"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using Random = std::default_random_engine;
+thread_local std::unique_ptr<Random> thread_random;
+
+Color &Color::operator=(const Color &other)
+{
+    if (this == &other)
+        return *this;
+    r = other.r;
+    g = other.g;
+    b = other.b;
+    return *this;
+}
+
+Color &Color::operator+=(const Color &rhs)
+{
+    r += rhs.r;
+    g += rhs.g;
+    b += rhs.b;
+    return *this;
+}
+
+Color &Color::operator-=(const Color &rhs)
+{
+    r -= rhs.r;
+    g -= rhs.g;
+    b -= rhs.b;
+    return *this;
+}
+
+Color &Color::operator*=(const Color &rhs)
+{
+    r *= rhs.r;
+    g *= rhs.g;
+    b *= rhs.b;
+    return *this;
+}
+
+Color &Color::operator*=(const float rhs)
+{
+    r *= rhs;
+    g *= rhs;
+    b *= rhs;
+    return *this;
+}
+
+Color operator+(Color lhs, const Color &rhs) { return (lhs += rhs); }
+Color operator-(Color lhs, const Color &rhs) { return (lhs -= rhs); }
+Color operator*(Color lhs, const Color &rhs) { return (lhs *= rhs); }
+Color operator*(Color lhs, const float rhs) { return (lhs *= rhs); }
+
+Image::Image(uint32_t width, uint32_t height, Format format)
+    : width(width), height(height), format(format), stride(get_stride(format)),
+      words(static_cast<size_t>(width) * height * stride)
+{
+    clear();
+}
+
+void Image::clear()
+{
+    // Start every pixel as opaque black, which is all zeros only for floating point pixels
+    if (format == Format::RGB32F || words.empty())
+    {
+        std::fill(words.begin(), words.end(), 0);
+        return;
+    }
+
+    set_pixel(0, 0, Color());
+    for (size_t i = stride; i < words.size(); i += stride)
+        std::copy_n(words.begin(), stride, words.begin() + i);
+}
+
+Color Image::get_pixel(float x, float y) const
+{
+    return get_pixel(
+        static_cast<uint32_t>(x * width),
+        static_cast<uint32_t>(y * width)
+    );
+}
+
+const uint8_t *Image::get_bytes(std::vector<uint8_t> &data, uint32_t &channels, ptrdiff_t &row_stride) const
+{
+    const uint8_t *pixels = reinterpret_cast<const uint8_t *>(words.data());
+
+    // RGBA8 pixels are already in a layout the encoders accept, and they skip the alpha themselves
+    channels = format == Format::RGBA8 ? 4 : 3;
+    if (format != Format::RGBA8)
+    {
+        data.resize(static_cast<size_t>(width) * height * 3);
+
+        auto convert_single = [](float value)
+        {
+            // Gamma correction and clamp
+            float corrected = std::sqrt(std::max(0.0f, std::min(value, 1.0f)));
+            return static_cast<uint8_t>(corrected * std::numeric_limits<uint8_t>::max());
+        };
+
+        parallel_for(0, height, [&](uint32_t y)
+        {
+            for (uint32_t x = 0; x < width; ++x)
+            {
+                Color pixel = get_pixel(x, y);
+                uint8_t *out = &data[(static_cast<size_t>(y) * width + x) * 3];
+                out[0] = convert_single(pixel.r);
+                out[1] = convert_single(pixel.g);
+                out[2] = convert_single(pixel.b);
+            }
+        }, false);
+        pixels = data.data();
+    }
+
+    // Encoders start with the top row, which is the last row of images drawn bottom up
+    row_stride = static_cast<ptrdiff_t>(width) * channels;
+    if (bottom_up && height > 0)
+    {
+        pixels += (height - 1) * row_stride;
+        row_stride = -row_stride;
+    }
+    return pixels;
+}
+
+
+void Image::write_file(const std::string &path, const PNGSettings &settings) const
+{
+    if (path.ends_with(".pfm"))
+    {
+        size_t row_size = static_cast<size_t>(width) * 3;
+        std::vector<float> data(row_size * height);
+        parallel_for(0, height, [&](uint32_t y)
+        {
+            for (uint32_t x = 0; x < width; ++x)
+            {
+                Color pixel = get_pixel(x, y);
+                std::memcpy(&data[y * row_size + x * 3], &pixel, sizeof(float) * 3);
+            }
+        }, false);
+
+        // PFM rows go from the bottom up, which is the order of images drawn bottom up
+        ptrdiff_t stride = static_cast<ptrdiff_t>(row_size);
+        if (bottom_up || height == 0)
+            write_pfm(path, width, height, data.data(), stride);
+        else
+            write_pfm(path, width, height, data.data() + (height - 1) * row_size, -stride);
+        return;
+    }
+
+    uint32_t channels;
+    ptrdiff_t stride;
+    std::vector<uint8_t> data;
+    const uint8_t *pixels = get_bytes(data, channels, stride);
+
+    if (path.ends_with(".ppm"))
+        write_ppm(path, width, height, channels, pixels, stride);
+    else if (path.ends_with(".qoi"))
+        write_qoi(path, width, height, channels, pixels, stride);
+    else
+        write_png(path, width, height, channels, pixels, stride, settings);
+}
+
+void Image::write_frame(Y4MWriter &video) const
+{
+    if (video.get_width() != width || video.get_height() != height)
+        throw std::runtime_error("Frame size does not match the video");
+
+    uint32_t channels;
+    ptrdiff_t stride;
+    std::vector<uint8_t> data;
+    const uint8_t *pixels = get_bytes(data, channels, stride);
+    video.write_frame(pixels, channels, stride);
+}
+
+void Image::write_rows(PNGWriter &png) const
+{
+    uint32_t channels;
+    ptrdiff_t stride;
+    std::vector<uint8_t> data;
+    const uint8_t *pixels = get_bytes(data, channels, stride);
+
+    if (png.get_width() != width)
+        throw std::runtime_error("Rows do not match the size of the PNG");
+    png.write_rows(pixels, channels, height, stride);
+}
+
+void Image::load_file(const std::string &path, Format format)
+{
+    MappedFile file(path);
+    load_memory(file.data(), file.size(), format);
+}
+
+void Image::load_memory(const uint8_t *contents, size_t size, Format format)
+{
+    uint32_t magic = 0;
+    if (size >= sizeof(magic))
+        std::memcpy(&magic, contents, sizeof(magic));
+
+    if (magic == container_magic)
+    {
+        BinaryReader reader(contents, size);
+        reader.read<uint32_t>();
+        if (reader.read<uint32_t>() != container_version)
+            throw std::runtime_error("Unsupported texture container version.");
+        reader.read<uint32_t>(); // flags
+        *this = Image(reader);
+        return;
+    }
+
+    int w, h, n;
+    int result = stbi_info_from_memory(contents, static_cast<int>(size), &w, &h, &n);
+    if (result == 0)
+        throw std::runtime_error("Error in STB library when reading image.");
+
+    *this = Image(static_cast<uint32_t>(w), static_cast<uint32_t>(h), format);
+
+    // 8-bit files are copied exactly, since RGBA8 pixels have the same layout and gamma
+    if (format == Format::RGBA8)
+    {
+        uint8_t *data = stbi_load_from_memory(contents, static_cast<int>(size), &w, &h, &n, 4);
+        if (data == nullptr)
+            throw std::runtime_error("Error in STB library when reading image.");
+        std::memcpy(words.data(), data, words.size() * sizeof(uint32_t));
+        stbi_image_free(data);
+        return;
+    }
+
+    // input between [0, 255]
+    auto convert_single = [](int value)
+    {
+        float corrected = value / 255.0f;
+        return corrected * corrected; // Gamma correction
+    };
+
+    uint8_t *data = stbi_load_from_memory(contents, static_cast<int>(size), &w, &h, &n, 3);
+    if (data == nullptr)
+        throw std::runtime_error("Error in STB library when reading image.");
+
+    for (uint32_t y = 0; y < height; ++y)
+    {
+        for (uint32_t x = 0; x < width; ++x)
+        {
+            size_t index = static_cast<size_t>(y) * width + x;
+            set_pixel(x, y, {convert_single(data[index * 3 + 0]), convert_single(data[index * 3 + 1]), convert_single(data[index * 3 + 2])});
+        }
+    }
+
+    stbi_image_free(data);
+}
+
+void Image::paste(const Image &source, uint32_t x, uint32_t y)
+{
+    if (source.format != format)
+        throw std::runtime_error("Pasted images must have the same format");
+    if (x >= width || y >= height)
+        return;
+
+    uint32_t columns = std::min(source.width, width - x);
+    uint32_t rows = std::min(source.height, height - y);
+    for (uint32_t row = 0; row < rows; ++row)
+        std::memcpy(&words[get_index(x, y + row) * stride], &source.words[source.get_index(0, row) * stride], columns * stride * sizeof(uint32_t));
+}
+
+void Image::generate_mips(bool normal_map)
+{
+    mips.clear();
+
+    const Image *source = this;
+    while (source->width > 1 || source->height > 1)
+    {
+        Image level(std::max(source->width / 2, 1U), std::max(source->height / 2, 1U));
+
+        for (uint32_t y = 0; y < level.height; ++y)
+        {
+            for (uint32_t x = 0; x < level.width; ++x)
+            {
+                // Average the 2x2 block of source pixels, clamping at the edges of odd sized images
+                uint32_t x0 = std::min(x * 2, source->width - 1), x1 = std::min(x * 2 + 1, source->width - 1);
+                uint32_t y0 = std::min(y * 2, source->height - 1), y1 = std::min(y * 2 + 1, source->height - 1);
+                Color color = (source->get_pixel(x0, y0) + source->get_pixel(x1, y0) +
+                               source->get_pixel(x0, y1) + source->get_pixel(x1, y1)) * 0.25f;
+
+                if (normal_map)
+                {
+                    // Averaging shortens the encoded normals, so restore them to unit length
+                    float nx = color.r * 2.0f - 1.0f, ny = color.g * 2.0f - 1.0f, nz = color.b * 2.0f - 1.0f;
+                    float length = std::sqrt(nx * nx + ny * ny + nz * nz);
+                    if (!almost_zero(length))
+                        color = Color(nx / length, ny / length, nz / length) * 0.5f + Color(0.5f);
+                }
+
+                level.set_pixel(x, y, color);
+            }
+        }
+
+        mips.push_back(std::move(level));
+        source = &mips.back();
+    }
+}
+
+size_t Image::memory_size() const
+{
+    size_t size = sizeof(Image) + words.capacity() * sizeof(uint32_t);
+    for (const Image &mip : mips)
+        size += mip.memory_size();
+    return size;
+}
+
+Image DepthBuffer::get_image() const
+{
+    // Depth is drawn by the rasterizer, with the first row at the bottom
+    Image image{width, height, Image::Format::RGBA8};
+    image.set_bottom_up(true);
+    for (uint32_t u = 0; u < width; ++u)
+        for (uint32_t v = 0; v < height; ++v)
+            image.set_pixel(u, v, Color{at(u, v)});
+    return image;
+}
+
+Image::Image(BinaryReader &reader)
+{
+    width = reader.read<uint32_t>();
+    height = reader.read<uint32_t>();
+    format = reader.read<Format>();
+    if (format > Format::RGBA16F)
+        throw std::runtime_error("Unknown image format");
+    stride = get_stride(format);
+    reader.read(words);
+
+    if (words.size() != static_cast<size_t>(width) * height * stride)
+        throw std::runtime_error("Image size does not match its pixels");
+
+    // Each level halves the size until it reaches a single pixel
+    uint64_t levels = reader.read<uint64_t>();
+    if (levels > 0 && levels >= static_cast<uint64_t>(std::bit_width(std::max(width, height))))
+        throw std::runtime_error("Image has more mip levels than its size allows");
+    mips.resize(levels);
+    for (Image &mip : mips)
+        mip = Image(reader);
+}
+
+void Image::write(BinaryWriter &writer) const
+{
+    writer.write(width);
+    writer.write(height);
+    writer.write(format);
+    writer.write(words);
+
+    writer.write<uint64_t>(mips.size());
+    for (const Image &mip : mips)
+        mip.write(writer);
+}
+
+void Image::write_container(const std::string &path) const
+{
+    BinaryWriter writer(path);
+    writer.write(container_magic);
+    writer.write(container_version);
+    writer.write<uint32_t>(0); // flags, reserved
+    write(writer);
+}
+
+uint64_t hash_bytes(const uint8_t *data, size_t size)
+{
+    uint64_t hash = 14695981039346656037ULL;
+
+    // Mixing in a whole word per step is much faster than one byte at a time for large files
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+    {
+        uint64_t word;
+        std::memcpy(&word, data + i, sizeof(word));
+        hash ^= word;
+        hash *= 1099511628211ULL;
+        hash ^= hash >> 32;
+    }
+
+    for (; i < size; ++i)
+    {
+        hash ^= data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+MappedFile::MappedFile(const std::string &path)
+{
+    int descriptor = open(path.c_str(), O_RDONLY);
+    if (descriptor < 0)
+        throw std::runtime_error("Unable to open file " + path);
+
+    struct stat status;
+    if (fstat(descriptor, &status) == 0 && status.st_size > 0)
+    {
+        length = static_cast<size_t>(status.st_size);
+        void *mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, descriptor, 0);
+        if (mapping == MAP_FAILED)
+        {
+            close(descriptor);
+            throw std::runtime_error("Unable to map file " + path);
+        }
+        bytes = static_cast<uint8_t *>(mapping);
+    }
+
+    // The mapping stays valid after the file is closed
+    close(descriptor);
+}
+
+MappedFile::~MappedFile()
+{
+    if (bytes != nullptr)
+        munmap(bytes, length);
+}
+
+BinaryWriter::BinaryWriter(const std::string &path) : file(path, std::ios::binary)
+{
+    if (!file.is_open())
+        throw std::runtime_error("Unable to open file " + path);
+}
+
+void BinaryWriter::write(const std::string &value)
+{
+    write<uint64_t>(value.size());
+    write_bytes(value.data(), value.size());
+}
+
+void BinaryWriter::write_bytes(const void *data, size_t size, size_t alignment)
+{
+    static const char padding[alignof(std::max_align_t)]{};
+    size_t offset = (alignment - position % alignment) % alignment;
+    position += offset + size;
+
+    if (!file.is_open())
+    {
+        bytes.append(padding, offset);
+        bytes.append(static_cast<const char *>(data), size);
+        return;
+    }
+
+    file.write(padding, static_cast<std::streamsize>(offset));
+    file.write(static_cast<const char *>(data), static_cast<std::streamsize>(size));
+
+    if (!file)
+        throw std::runtime_error("Unable to write binary file");
+}
+
+std::string BinaryReader::read_string()
+{
+    std::string value(read_count(1), '\0');
+    read_bytes(value.data(), value.size());
+    return value;
+}
+
+void BinaryReader::read_bytes(void *data, size_t size, size_t alignment)
+{
+    position += (alignment - position % alignment) % alignment;
+    if (position > length || size > length - position)
+        throw std::runtime_error("Unexpected end of binary file");
+
+    std::memcpy(data, bytes + position, size);
+    position += size;
+}
+
+size_t BinaryReader::read_count(size_t element_size, size_t alignment)
+{
+    uint64_t count = read<uint64_t>();
+
+    // Dividing the space left avoids overflowing the size of the elements
+    size_t start = position + (alignment - position % alignment) % alignment;
+    if (start > length || count > (length - start) / element_size)
+        throw std::runtime_error("Unexpected end of binary file");
+    return static_cast<size_t>(count);
+}
+
+static Random *make_random_engine(uint32_t seed)
+{
+    auto random = std::make_unique<Random>(seed);
+    Random *result = random.get();
+    thread_random = std::move(random);
+    return result;
+}
+
+float random_float()
+{
+    Random *random = thread_random.get();
+    if (random == nullptr)
+        random = make_random_engine(0);
+    std::uniform_real_distribution<float> distribution;
+    return distribution(*random);
+}
+
+// https://gist.github.com/rygorous/2156668
+uint16_t float_to_half(float value)
+{
+    uint32_t bits = std::bit_cast<uint32_t>(value);
+    uint32_t sign = (bits >> 16) & 0x8000u;
+    bits &= 0x7FFFFFFFu;
+
+    // NaN stays NaN and anything too large becomes infinity
+    if (bits >= 0x47800000u)
+        return static_cast<uint16_t>(sign | (bits > 0x7F800000u ? 0x7E00u : 0x7C00u));
+
+    // Too small to be normalized, let the float hardware do the rounding
+    if (bits < 0x38800000u)
+    {
+        float denormal = std::bit_cast<float>(bits) + 0.5f;
+        return static_cast<uint16_t>(sign | (std::bit_cast<uint32_t>(denormal) - 0x3F000000u));
+    }
+
+    // Rebias the exponent and round the mantissa to nearest even
+    uint32_t odd = (bits >> 13) & 1u;
+    bits += 0xC8000FFFu + odd;
+    return static_cast<uint16_t>(sign | (bits >> 13));
+}
+
+float half_to_float(uint16_t value)
+{
+    uint32_t sign = static_cast<uint32_t>(value & 0x8000u) << 16;
+    uint32_t exponent = (value >> 10) & 0x1Fu;
+    uint32_t mantissa = value & 0x3FFu;
+
+    // Denormalized values are multiples of 2^-24
+    if (exponent == 0)
+    {
+        float magnitude = mantissa * 5.9604645e-8f;
+        return sign ? -magnitude : magnitude;
+    }
+    if (exponent == 31)
+        return std::bit_cast<float>(sign | 0x7F800000u | (mantissa << 13));
+
+    return std::bit_cast<float>(sign | ((exponent + 112) << 23) | (mantissa << 13));
+}
+
+void parallel_for(uint32_t begin, uint32_t end, const std::function<void(uint32_t)> &action, bool show_progress)
+{
+    auto print_done = []()
+    { std::printf("\r       \rdone\n"); };
+
+    if (end == begin)
+    {
+        if (show_progress)
+            print_done();
+        return;
+    }
+
+    if (end < begin)
+        std::swap(begin, end);
+
+    uint32_t workers = std::thread::hardware_concurrency();
+    workers = std::min(std::max(workers, 1U), end - begin);
+
+    std::vector<std::thread> threads;
+    std::atomic<uint32_t> current = begin;
+
+    for (uint32_t i = 0; i < workers; ++i)
+    {
+        auto entry = [i, end, &current, &action]()
+        {
+            make_random_engine(i);
+
+            while (true)
+            {
+                uint32_t index = current++;
+                if (index >= end)
+                    break;
+                action(index);
+            }
+        };
+
+        auto entry_print = [begin, end, &current, &action]()
+        {
+            make_random_engine(0);
+
+            while (true)
+            {
+                uint32_t index = current++;
+                if (index >= end)
+                    break;
+
+                uint32_t done = index - begin;
+                uint32_t total = end - begin;
+                std::printf("\r%5.2f %%", static_cast<float>(done) / total * 100.0f);
+                std::cout << std::flush;
+
+                action(index);
+            }
+        };
+
+        if (i > 0 || not show_progress)
+            threads.emplace_back(entry);
+        else
+            threads.emplace_back(entry_print);
+    }
+
+    for (auto &thread : threads)
+        thread.join();
+    if (show_progress)
+        print_done();
+}
+
+ThreadPool::ThreadPool(uint32_t workers)
+{
+    workers = std::max(workers, 1U);
+    for (uint32_t i = 0; i < workers; ++i)
+    {
+        threads.emplace_back([this, i]()
+                             {
+                                 make_random_engine(i);
+                                 run(); });
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    condition.notify_all();
+
+    for (auto &thread : threads)
+        thread.join();
+}
+
+void ThreadPool::run()
+{
+    while (true)
+    {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            condition.wait(lock, [this]()
+                           { return stopping || !tasks.empty(); });
+
+            if (tasks.empty())
+                return;
+
+            task = std::move(tasks.front());
+            tasks.pop();
+        }
+        task();
+    }
+}
+
+FrameWriter::~FrameWriter()
+{
+    try
+    {
+        wait();
+    }
+    catch (const std::exception &error)
+    {
+        std::cerr << "Error: " << error.what() << "\n";
+    }
+}
+
+void FrameWriter::write(Image image, std::string path, PNGSettings settings)
+{
+    submit([image = std::move(image), path = std::move(path), settings]()
+           { image.write_file(path, settings); });
+}
+
+void FrameWriter::write(DepthBuffer depth, std::string path)
+{
+    submit([depth = std::move(depth), path = std::move(path)]()
+           { depth.get_image().write_file(path); });
+}
+
+void FrameWriter::write(std::shared_ptr<const Image> image, std::string path, PNGSettings settings)
+{
+    submit([image = std::move(image), path = std::move(path), settings]()
+           { image->write_file(path, settings); });
+}
+
+void FrameWriter::write(std::shared_ptr<const DepthBuffer> depth, std::string path)
+{
+    submit([depth = std::move(depth), path = std::move(path)]()
+           { depth->get_image().write_file(path); });
+}
+
+void FrameWriter::write(Image image, Y4MWriter &video)
+{
+    submit([image = std::move(image), &video]()
+           { image.write_frame(video); });
+}
+
+void FrameWriter::wait()
+{
+    while (!pending.empty())
+    {
+        std::future<void> frame = std::move(pending.front());
+        pending.pop_front();
+        frame.get();
+    }
+}
+
+void FrameWriter::submit(std::function<void()> task)
+{
+    // Collect frames that are already done, and wait for the oldest while the queue is full
+    while (!pending.empty() && (pending.size() >= max_pending ||
+                                pending.front().wait_for(std::chrono::seconds(0)) == std::future_status::ready))
+    {
+        std::future<void> frame = std::move(pending.front());
+        pending.pop_front();
+        frame.get();
+    }
+
+    pending.push_back(pool.submit(std::move(task)));
+}
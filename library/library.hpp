@@ -1,153 +1,587 @@
-/* This file is part of the Michigan Computer Graphics rasterization workshop.
- * Copyright (C) 2025  Aidan Rhys Donley
- *
- * This program is free software: you can redistribute it and/or modify
- * it under the terms of the GNU General Public License as published by
- * the Free Software Foundation, either version 3 of the License, or
- * (at your option) any later version.
- *
- * This program is distributed in the hope that it will be useful,
- * but WITHOUT ANY WARRANTY; without even the implied warranty of
- * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
- * GNU General Public License for more details.
- *
- * You should have received a copy of the GNU General Public License
- * along with this program.  If not, see <https://www.gnu.org/licenses/>.
- */
-
-#pragma once
-
-#include "../thirdparty/stb/stb_image_write.h"
-
-#include <cmath>
-#include <tuple>
-#include <string>
-#include <vector>
-#include <numbers>
-#include <cstdint>
-#include <functional>
-#include <chrono>
-
-constexpr float Infinity = std::numeric_limits<float>::infinity();
-constexpr float Pi = std::numbers::pi_v<float>;
-
-struct Color
-{
-    Color(float r, float g, float b) : r(r), g(g), b(b) {}
-    explicit Color(float value = 0.0f) : r(value), g(value), b(value) {}
-
-    float r, g, b;
-
-    Color &operator=(const Color &rhs);
-    Color &operator+=(const Color &rhs);
-    Color &operator-=(const Color &rhs);
-    Color &operator*=(const Color &rhs);
-    Color &operator*=(const float);
-};
-
-Color operator+(Color lhs, const Color &rhs);
-Color operator-(Color lhs, const Color &rhs);
-Color operator*(Color lhs, const Color &rhs);
-Color operator*(Color lhs, const float);
-
-/**
- * Returns if a value is very close to zero.
- * @param epsilon The threshold used to make this decision.
- */
-inline bool almost_zero(float value, float epsilon = 8E-7f) { return -epsilon < value && value < epsilon; }
-
-/**
- * Takes the square root of a number while avoiding negative numbers from rounding errors.
- * @return The square root of value if value is positive, otherwise zero.
- */
-inline float safe_sqrt(float value) { return value <= 0.0f ? 0.0f : std::sqrt(value); }
-
-/**
- * @return A random floating point value between 0 (inclusive) and 1 (exclusive).
- */
-float random_float();
-
-class Image
-{
-public:
-    Image() : width(0), height(0), pixels(0) {}
-    Image(uint32_t width, uint32_t height) : width(width), height(height), pixels(width * height) {}
-    Image(const std::string &path) { load_file(path); }
-
-    Color get_pixel(uint32_t x, uint32_t y) const { return pixels[get_index(x, y)]; }
-    Color get_pixel(float x, float y) const;
-    void set_pixel(uint32_t x, uint32_t y, const Color &color) { pixels[get_index(x, y)] = color; }
-
-    /**
-     * Outputs this image as a PNG image file.
-     */
-    void write_file(const std::string &path) const;
-    void load_file(const std::string &path);
-
-    uint32_t get_width() const { return width; }
-    uint32_t get_height() const { return height; }
-
-    explicit operator bool() const { return pixels.capacity() != 0; }
-
-private:
-    inline uint32_t get_index(uint32_t x, uint32_t y) const { return x + width * y; }
-
-    uint32_t width;
-    uint32_t height;
-    std::vector<Color> pixels;
-};
-
-class DepthBuffer
-{
-public:
-    DepthBuffer(uint32_t width, uint32_t height) : width(width), height(height), data(width * height, 0.0f) {}
-
-    float at(uint32_t x, uint32_t y) const { return data[y * width + x]; };
-    float &at(uint32_t x, uint32_t y) { return data[y * width + x]; };
-
-    uint32_t get_width() const { return width; }
-    uint32_t get_height() const { return height; }
-
-    Image get_image() const;
-
-private:
-    uint32_t width, height;
-    std::vector<float> data;
-};
-
-class Timer
-{
-private:
-	using Clock = std::chrono::high_resolution_clock;
-	using Second = std::chrono::milliseconds;
-
-	std::chrono::time_point<Clock> start { Clock::now() };
-
-public:
-	double elapsed() const { return std::chrono::duration_cast<Second>(Clock::now() - start).count(); }
-};
-
-/**
- * Returns the luminance value of a color.
- * This can be thought of as the visually perceived brightness.
- */
-inline float get_luminance(Color color) { return color.r * 0.212671f + color.g * 0.715160f + color.b * 0.072169f; }
-
-/**
- * Returns whether a color is almost black.
- */
-inline bool almost_black(Color color) { return almost_zero(get_luminance(color)); }
-
-/**
- * @return Whether a color value is valid (i.e. not NaN).
- */
-inline bool is_invalid(Color color) { return not std::isfinite(color.r + color.g + color.b); }
-
-/**
- * Executes an action in parallel, taking advantage of multiple threads.
- * Also optionally prints the execution progress in standard out.
- * @param begin The first index to execute (inclusive).
- * @param end One past the last index to execute (exclusive).
- * @param action The action to execute in parallel.
- */
-void parallel_for(uint32_t begin, uint32_t end, const std::function<void(uint32_t)> &action, bool show_progress = true);
\ No newline at end of file
+/* This file is part of the Michigan Computer Graphics rasterization workshop.
+ * Copyright (C) 2025  Aidan Rhys Donley
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "../thirdparty/stb/stb_image_write.h"
+#include "encode.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <tuple>
+#include <string>
+#include <vector>
+#include <numbers>
+#include <cstdint>
+#include <functional>
+#include <fstream>
+#include <type_traits>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+
+constexpr float Infinity = std::numeric_limits<float>::infinity();
+constexpr float Pi = std::numbers::pi_v<float>;
+
+struct Color
+{
+    Color(float r, float g, float b) : r(r), g(g), b(b) {}
+    explicit Color(float value = 0.0f) : r(value), g(value), b(value) {}
+
+    float r, g, b;
+
+    // The assignment only copies the fields, so bundles can store this as bytes
+    using plain_data = void;
+
+    Color &operator=(const Color &rhs);
+    Color &operator+=(const Color &rhs);
+    Color &operator-=(const Color &rhs);
+    Color &operator*=(const Color &rhs);
+    Color &operator*=(const float);
+};
+
+Color operator+(Color lhs, const Color &rhs);
+Color operator-(Color lhs, const Color &rhs);
+Color operator*(Color lhs, const Color &rhs);
+Color operator*(Color lhs, const float);
+
+/**
+ * Returns if a value is very close to zero.
+ * @param epsilon The threshold used to make this decision.
+ */
+inline bool almost_zero(float value, float epsilon = 8E-7f) { return -epsilon < value && value < epsilon; }
+
+/**
+ * Takes the square root of a number while avoiding negative numbers from rounding errors.
+ * @return The square root of value if value is positive, otherwise zero.
+ */
+inline float safe_sqrt(float value) { return value <= 0.0f ? 0.0f : std::sqrt(value); }
+
+/**
+ * Clamps a value between 0 and 1.
+ */
+inline float saturate(float value) { return std::min(1.0f, std::max(0.0f, value)); }
+
+/**
+ * @return A random floating point value between 0 (inclusive) and 1 (exclusive).
+ */
+float random_float();
+
+/**
+ * Converts a float into the bits of an IEEE 754 half precision float, rounding to the nearest value.
+ */
+uint16_t float_to_half(float value);
+
+/**
+ * Converts the bits of an IEEE 754 half precision float into a float.
+ */
+float half_to_float(uint16_t value);
+
+/**
+ * A read-only view of a whole file mapped into memory.
+ */
+class MappedFile
+{
+public:
+    MappedFile(const std::string &path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    const uint8_t *data() const { return bytes; }
+    size_t size() const { return length; }
+
+private:
+    uint8_t *bytes = nullptr;
+    size_t length = 0;
+};
+
+// Types that can be saved and loaded as raw bytes. Trivially copyable types may still hold
+// pointers, and standard layout types may own memory like a std::string, so both are required.
+// Types whose hand-written copies only copy their fields opt in with `using plain_data = void;`,
+// since defaulting those copies changes how they are passed and slows down the math.
+template <typename T>
+inline constexpr bool is_plain_data = (std::is_trivially_copyable_v<T> || requires { typename T::plain_data; }) &&
+                                      std::is_standard_layout_v<T> && !std::is_pointer_v<T> && !std::is_member_pointer_v<T>;
+
+/**
+ * Writes plain values into a binary file in the native byte order.
+ * Every value is padded to its alignment, so a reader can copy arrays straight out of the file.
+ */
+class BinaryWriter
+{
+public:
+    BinaryWriter(const std::string &path);
+
+    /**
+     * Writes into memory instead of a file, which can be read back with `get_bytes`.
+     */
+    BinaryWriter() = default;
+
+    template <typename T>
+    void write(const T &value)
+    {
+        static_assert(is_plain_data<T>, "Only types made of plain numbers can be copied as bytes");
+        write_bytes(&value, sizeof(T), alignof(T));
+    }
+
+    template <typename T>
+    void write(const std::vector<T> &values)
+    {
+        static_assert(is_plain_data<T>, "Only types made of plain numbers can be copied as bytes");
+        write<uint64_t>(values.size());
+        write_bytes(values.data(), values.size() * sizeof(T), alignof(T));
+    }
+
+    void write(const std::string &value);
+
+    void write_bytes(const void *data, size_t size, size_t alignment = 1);
+
+    // Returns everything written so far by a writer without a file
+    const std::string &get_bytes() const { return bytes; }
+
+private:
+    std::ofstream file;
+    std::string bytes;
+    size_t position = 0;
+};
+
+/**
+ * Reads values written by a `BinaryWriter` from a memory mapped file or a block of memory.
+ */
+class BinaryReader
+{
+public:
+    BinaryReader(const std::string &path) : file(std::make_unique<MappedFile>(path)), bytes(file->data()), length(file->size()) {}
+
+    // The memory must outlive the reader
+    BinaryReader(const uint8_t *data, size_t size) : bytes(data), length(size) {}
+
+    template <typename T>
+    T read()
+    {
+        static_assert(is_plain_data<T>, "Only types made of plain numbers can be copied as bytes");
+        T value;
+        read_bytes(&value, sizeof(T), alignof(T));
+        return value;
+    }
+
+    template <typename T>
+    void read(std::vector<T> &values)
+    {
+        static_assert(is_plain_data<T>, "Only types made of plain numbers can be copied as bytes");
+        values.resize(read_count(sizeof(T), alignof(T)));
+        read_bytes(values.data(), values.size() * sizeof(T), alignof(T));
+    }
+
+    std::string read_string();
+
+    void read_bytes(void *data, size_t size, size_t alignment = 1);
+
+    /**
+     * Reads the length of an array, checking that its elements fit in the rest of the data
+     * before anything is allocated for them.
+     */
+    size_t read_count(size_t element_size, size_t alignment = 1);
+
+private:
+    std::unique_ptr<MappedFile> file;
+    const uint8_t *bytes;
+    size_t length;
+    size_t position = 0;
+};
+
+class Image
+{
+public:
+    /**
+     * How the pixels are stored in memory. Textures keep full floats, while render targets
+     * can use a smaller format so shading writes less memory.
+     */
+    enum class Format : uint32_t
+    {
+        // Three 32-bit floats
+        RGB32F,
+        // Four 8-bit gamma corrected channels, which are written to files as they are
+        RGBA8,
+        // Three 10-bit gamma corrected channels and a 2-bit alpha
+        RGB10A2,
+        // Four half floats, which keep colors outside of [0, 1]
+        RGBA16F,
+    };
+
+    Image() : width(0), height(0), format(Format::RGB32F) {}
+    Image(uint32_t width, uint32_t height, Format format = Format::RGB32F);
+    Image(const std::string &path) { load_file(path); }
+    Image(BinaryReader &reader);
+
+    Color get_pixel(uint32_t x, uint32_t y) const;
+    Color get_pixel(float x, float y) const;
+    void set_pixel(uint32_t x, uint32_t y, const Color &color);
+
+    Format get_format() const { return format; }
+
+    /**
+     * Marks the first row of the image as its bottom row, which is how the rasterizer draws.
+     * Such images are flipped when they are written.
+     */
+    void set_bottom_up(bool value) { bottom_up = value; }
+    bool is_bottom_up() const { return bottom_up; }
+
+    /**
+     * Outputs this image as a file, picking the encoder from the extension: `.ppm`, `.pfm`, `.qoi`, or PNG otherwise.
+     * Images are written as 8-bit RGB, converting formats other than RGBA8 and leaving out the alpha, which is always opaque.
+     * PFM files store the linear colors as floats instead.
+     * Files always start with the top row, so images drawn bottom up are flipped, see `set_bottom_up`.
+     */
+    void write_file(const std::string &path, const PNGSettings &settings = {}) const;
+    void load_file(const std::string &path, Format format = Format::RGB32F);
+
+    /**
+     * Appends this image to a video stream as its next frame, converting and flipping it like `write_file`.
+     */
+    void write_frame(Y4MWriter &video) const;
+
+    /**
+     * Appends the rows of this image to a PNG being written in parts, converting and flipping them like `write_file`.
+     * This lets a large image be saved one strip at a time.
+     */
+    void write_rows(PNGWriter &png) const;
+
+    /**
+     * Decodes an image from the contents of an image file that is already in memory.
+     * Texture containers written by `write_container` are copied directly without decoding.
+     * @param format The format the decoded pixels are stored in. Loading into RGBA8 keeps the exact 8-bit values.
+     */
+    void load_memory(const uint8_t *contents, size_t size, Format format = Format::RGB32F);
+
+    /**
+     * Resets every pixel to opaque black so the image can be reused for another frame.
+     */
+    void clear();
+
+    /**
+     * Copies an image of the same format into this one, with its first pixel placed at (x, y).
+     * Anything that falls outside of this image is cut off.
+     */
+    void paste(const Image &source, uint32_t x, uint32_t y);
+
+    /**
+     * Stores the decoded pixels and mip levels so they can be read back without decoding the original file again.
+     */
+    void write(BinaryWriter &writer) const;
+
+    /**
+     * Outputs this image and its mip levels as a texture container, which loads without any decoding.
+     */
+    void write_container(const std::string &path) const;
+
+    /**
+     * Builds a chain of mip levels, each half the size of the last, down to a single pixel.
+     * @param normal_map Whether the pixels are encoded normals, which are renormalized after filtering.
+     */
+    void generate_mips(bool normal_map = false);
+
+    // Returns the number of mip levels, not including the full size image
+    size_t mip_size() const { return mips.size(); }
+
+    // Returns a mip level, where level 0 is the full size image
+    const Image &get_mip(size_t level) const { return level == 0 ? *this : mips[level - 1]; }
+
+    uint32_t get_width() const { return width; }
+    uint32_t get_height() const { return height; }
+
+    /**
+     * Returns the number of bytes used by this image, including its pixel storage.
+     */
+    size_t memory_size() const;
+
+    explicit operator bool() const { return words.capacity() != 0; }
+
+private:
+    inline size_t get_index(uint32_t x, uint32_t y) const { return x + static_cast<size_t>(width) * y; }
+
+    // Returns the number of 32-bit words used by each pixel in a format
+    static uint32_t get_stride(Format format);
+
+    // Returns the pixels as 8 bits per channel starting from the top row, converted into `data` when needed.
+    // RGBA8 pixels are returned in place with their alpha, which the encoders skip.
+    const uint8_t *get_bytes(std::vector<uint8_t> &data, uint32_t &channels, ptrdiff_t &row_stride) const;
+
+    static constexpr uint32_t container_magic = 0x58545352; // "RSTX"
+    static constexpr uint32_t container_version = 2;
+
+    uint32_t width;
+    uint32_t height;
+    Format format;
+    uint32_t stride = 3;
+    bool bottom_up = false;
+    // The pixels packed into 32-bit words according to the format
+    std::vector<uint32_t> words;
+
+    // Successively halved copies of the image, used for sampling at a distance
+    std::vector<Image> mips;
+};
+
+inline uint32_t Image::get_stride(Format format)
+{
+    switch (format)
+    {
+        case Format::RGBA8:
+        case Format::RGB10A2:
+            return 1;
+        case Format::RGBA16F:
+            return 2;
+        default:
+            return 3;
+    }
+}
+
+inline Color Image::get_pixel(uint32_t x, uint32_t y) const
+{
+    const uint32_t *pixel = &words[get_index(x, y) * stride];
+
+    // The encoded channels are squared to undo the gamma correction
+    auto decode = [](uint32_t value, float max)
+    {
+        float linear = value / max;
+        return linear * linear;
+    };
+
+    switch (format)
+    {
+        case Format::RGBA8:
+            return {decode(pixel[0] & 0xFF, 255.0f), decode((pixel[0] >> 8) & 0xFF, 255.0f), decode((pixel[0] >> 16) & 0xFF, 255.0f)};
+        case Format::RGB10A2:
+            return {decode(pixel[0] & 0x3FF, 1023.0f), decode((pixel[0] >> 10) & 0x3FF, 1023.0f), decode((pixel[0] >> 20) & 0x3FF, 1023.0f)};
+        case Format::RGBA16F:
+            return {half_to_float(pixel[0] & 0xFFFF), half_to_float(pixel[0] >> 16), half_to_float(pixel[1] & 0xFFFF)};
+        default:
+            return {std::bit_cast<float>(pixel[0]), std::bit_cast<float>(pixel[1]), std::bit_cast<float>(pixel[2])};
+    }
+}
+
+inline void Image::set_pixel(uint32_t x, uint32_t y, const Color &color)
+{
+    uint32_t *pixel = &words[get_index(x, y) * stride];
+
+    // Gamma correction and clamp, matching the conversion done when writing a file
+    auto encode = [](float value, float max)
+    { return static_cast<uint32_t>(std::sqrt(saturate(value)) * max); };
+
+    switch (format)
+    {
+        case Format::RGBA8:
+            pixel[0] = encode(color.r, 255.0f) | encode(color.g, 255.0f) << 8 | encode(color.b, 255.0f) << 16 | 0xFF000000u;
+            break;
+        case Format::RGB10A2:
+            pixel[0] = encode(color.r, 1023.0f) | encode(color.g, 1023.0f) << 10 | encode(color.b, 1023.0f) << 20 | 0xC0000000u;
+            break;
+        case Format::RGBA16F:
+            pixel[0] = float_to_half(color.r) | static_cast<uint32_t>(float_to_half(color.g)) << 16;
+            pixel[1] = float_to_half(color.b) | static_cast<uint32_t>(float_to_half(1.0f)) << 16;
+            break;
+        default:
+            pixel[0] = std::bit_cast<uint32_t>(color.r);
+            pixel[1] = std::bit_cast<uint32_t>(color.g);
+            pixel[2] = std::bit_cast<uint32_t>(color.b);
+            break;
+    }
+}
+
+class DepthBuffer
+{
+public:
+    DepthBuffer(uint32_t width, uint32_t height) : width(width), height(height), data(static_cast<size_t>(width) * height, 0.0f) {}
+
+    float at(uint32_t x, uint32_t y) const { return data[static_cast<size_t>(y) * width + x]; };
+    float &at(uint32_t x, uint32_t y) { return data[static_cast<size_t>(y) * width + x]; };
+
+    uint32_t get_width() const { return width; }
+    uint32_t get_height() const { return height; }
+
+    // Resets every pixel to the far plane so the buffer can be reused for another frame
+    void clear() { std::fill(data.begin(), data.end(), 0.0f); }
+
+    Image get_image() const;
+
+private:
+    uint32_t width, height;
+    std::vector<float> data;
+};
+
+class Timer
+{
+private:
+	using Clock = std::chrono::high_resolution_clock;
+	using Second = std::chrono::milliseconds;
+
+	std::chrono::time_point<Clock> start { Clock::now() };
+
+public:
+	double elapsed() const { return std::chrono::duration_cast<Second>(Clock::now() - start).count(); }
+};
+
+/**
+ * Computes a 64-bit hash of some bytes, using the FNV-1a steps on 8 bytes at a time.
+ * The result is only meant for comparing data within a single run.
+ * http://www.isthe.com/chongo/tech/comp/fnv/index.html
+ */
+uint64_t hash_bytes(const uint8_t *data, size_t size);
+
+/**
+ * Returns the luminance value of a color.
+ * This can be thought of as the visually perceived brightness.
+ */
+inline float get_luminance(Color color) { return color.r * 0.212671f + color.g * 0.715160f + color.b * 0.072169f; }
+
+/**
+ * Returns whether a color is almost black.
+ */
+inline bool almost_black(Color color) { return almost_zero(get_luminance(color)); }
+
+/**
+ * @return Whether a color value is valid (i.e. not NaN).
+ */
+inline bool is_invalid(Color color) { return not std::isfinite(color.r + color.g + color.b); }
+
+/**
+ * Executes an action in parallel, taking advantage of multiple threads.
+ * Also optionally prints the execution progress in standard out.
+ * @param begin The first index to execute (inclusive).
+ * @param end One past the last index to execute (exclusive).
+ * @param action The action to execute in parallel.
+ */
+void parallel_for(uint32_t begin, uint32_t end, const std::function<void(uint32_t)> &action, bool show_progress = true);
+
+/**
+ * A fixed set of worker threads that run submitted tasks in the order they are received.
+ * Unlike `parallel_for`, the threads are kept alive between tasks.
+ */
+class ThreadPool
+{
+public:
+    /**
+     * Starts the worker threads.
+     * @param workers The number of threads, defaults to one per hardware thread.
+     */
+    explicit ThreadPool(uint32_t workers = std::thread::hardware_concurrency());
+
+    /**
+     * Finishes all submitted tasks before stopping the worker threads.
+     */
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    /**
+     * Queues a task to be run on one of the worker threads.
+     * @return A future holding the result of the task, or the exception it threw.
+     */
+    template <typename F>
+    std::future<std::invoke_result_t<F>> submit(F &&task)
+    {
+        // std::function must be copyable, so the packaged task is shared
+        auto packaged = std::make_shared<std::packaged_task<std::invoke_result_t<F>()>>(std::forward<F>(task));
+        auto future = packaged->get_future();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.emplace([packaged]()
+                          { (*packaged)(); });
+        }
+        condition.notify_one();
+        return future;
+    }
+
+    size_t size() const { return threads.size(); }
+
+private:
+    void run();
+
+    std::vector<std::thread> threads;
+    std::queue<std::function<void()>> tasks;
+
+    std::mutex mutex;
+    std::condition_variable condition;
+    bool stopping = false;
+};
+
+/**
+ * Encodes and writes finished frames on a background thread, so rendering can
+ * continue while the previous results are still being saved.
+ * Frames are written in the order they are handed over.
+ */
+class FrameWriter
+{
+public:
+    /**
+     * @param max_pending The number of frames that may wait to be written before
+     * `write` blocks, which bounds the memory held by the queue.
+     */
+    explicit FrameWriter(size_t max_pending = 2) : max_pending(std::max(max_pending, size_t{1})) {}
+
+    /**
+     * Writes all remaining frames, printing any errors since destructors cannot throw.
+     */
+    ~FrameWriter();
+
+    FrameWriter(const FrameWriter &) = delete;
+    FrameWriter &operator=(const FrameWriter &) = delete;
+
+    /**
+     * Queues an image to be written, the format is chosen by the file extension.
+     */
+    void write(Image image, std::string path, PNGSettings settings = {});
+
+    /**
+     * Queues a depth buffer to be converted to an image and written.
+     */
+    void write(DepthBuffer depth, std::string path);
+
+    /**
+     * Queues a shared image to be written without copying it.
+     * The caller must not change the image until `wait` returns.
+     */
+    void write(std::shared_ptr<const Image> image, std::string path, PNGSettings settings = {});
+    void write(std::shared_ptr<const DepthBuffer> depth, std::string path);
+
+    /**
+     * Queues an image to be appended to a video stream, which must outlive the queued frames.
+     */
+    void write(Image image, Y4MWriter &video);
+
+    /**
+     * Blocks until every queued frame has been written.
+     * Rethrows the first error raised while writing.
+     */
+    void wait();
+
+private:
+    void submit(std::function<void()> task);
+
+    ThreadPool pool{1};
+    std::deque<std::future<void>> pending;
+    size_t max_pending;
+};
@@ -17,11 +17,185 @@
 
 #include "light.hpp"
 
+#include <algorithm>
+#include <cmath>
 #include <fstream>
-#include <iostream>
+#include <stdexcept>
 
-float saturate(float value) {
-    return std::min(1.0f, std::max(0.0f, value));
+std::shared_ptr<const Image> load_texture_file(const std::string &path) { return std::make_shared<const Image>(path); }
+
+void LightCollection::build_sampler(size_t sample_count, const BoundingBox &box)
+{
+    this->sample_count = 0;
+    buckets.clear();
+    weights.clear();
+    if (sample_count == 0 || lights.empty())
+        return;
+
+    std::vector<float> strengths(lights.size());
+    float total = 0;
+    for (size_t i = 0; i < lights.size(); ++i)
+        total += strengths[i] = std::max(lights[i]->estimate_strength(box), 0.0f);
+    if (!(total > 0.0f) || !std::isfinite(total))
+        return;
+
+    // Every light keeps a small chance of being picked so that the estimate stays unbiased
+    size_t count = lights.size();
+    float floor = total * 1E-3f / count;
+    total = 0;
+    for (float &strength : strengths)
+        total += strength = std::max(strength, floor);
+
+    weights.resize(count);
+    buckets.resize(count);
+
+    // Scale the probabilities so that the average bucket is exactly full, then pair
+    // each underfull bucket with an overfull one that tops it up
+    std::vector<uint32_t> small, large;
+    std::vector<float> scaled(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        weights[i] = total / (strengths[i] * sample_count);
+        scaled[i] = strengths[i] * count / total;
+        (scaled[i] < 1.0f ? small : large).push_back(i);
+    }
+
+    while (!small.empty() && !large.empty())
+    {
+        uint32_t less = small.back(), more = large.back();
+        small.pop_back();
+        buckets[less] = {scaled[less], more};
+
+        scaled[more] -= 1.0f - scaled[less];
+        if (scaled[more] < 1.0f)
+        {
+            large.pop_back();
+            small.push_back(more);
+        }
+    }
+
+    // Anything left over is full up to rounding errors
+    for (uint32_t i : small)
+        buckets[i] = {1.0f, i};
+    for (uint32_t i : large)
+        buckets[i] = {1.0f, i};
+
+    this->sample_count = sample_count;
+}
+
+LightCollection::Sample LightCollection::sample() const
+{
+    float u = random_float() * buckets.size();
+    uint32_t i = std::min(static_cast<uint32_t>(u), static_cast<uint32_t>(buckets.size() - 1));
+    if (u - i >= buckets[i].probability)
+        i = buckets[i].alias;
+    return {lights[i].get(), weights[i]};
+}
+
+// The first nine real spherical harmonics basis functions evaluated for a direction
+static std::array<float, 9> sh_basis(const Vec4 &d)
+{
+    return {
+        0.282095f,
+        0.488603f * d.y,
+        0.488603f * d.z,
+        0.488603f * d.x,
+        1.092548f * d.x * d.y,
+        1.092548f * d.y * d.z,
+        0.315392f * (3.0f * d.z * d.z - 1.0f),
+        1.092548f * d.x * d.z,
+        0.546274f * (d.x * d.x - d.y * d.y),
+    };
+}
+
+void LightCollection::build_irradiance(const BoundingBox &box)
+{
+    // Convolving with the clamped cosine lobe scales each band by these factors
+    static constexpr float band_scale[9] = {Pi, 2 * Pi / 3, 2 * Pi / 3, 2 * Pi / 3, Pi / 4, Pi / 4, Pi / 4, Pi / 4, Pi / 4};
+
+    irradiance.fill(Color());
+    irradiance_lights = 0;
+    if (box.empty())
+        return;
+
+    Vec4 center = box.center();
+    std::vector<std::shared_ptr<const Light>> near;
+
+    for (const auto &light : lights)
+    {
+        if (!light->is_distant(box))
+        {
+            near.push_back(light);
+            continue;
+        }
+
+        // Treat the light as a directional light with its strength at the center of the box
+        Color strength = light->get_color() * light->get_attenuation(center);
+        std::array<float, 9> basis = sh_basis(light->get_direction(center));
+        for (size_t i = 0; i < 9; ++i)
+            irradiance[i] += strength * (basis[i] * band_scale[i]);
+        ++irradiance_lights;
+    }
+
+    lights = std::move(near);
+}
+
+Color LightCollection::get_irradiance(const Vec4 &normal) const
+{
+    std::array<float, 9> basis = sh_basis(normal);
+    Color color;
+    for (size_t i = 0; i < 9; ++i)
+        color += irradiance[i] * basis[i];
+
+    // Only nine coefficients cannot represent a sharp light exactly, which can ring slightly below zero
+    return {std::max(color.r, 0.0f), std::max(color.g, 0.0f), std::max(color.b, 0.0f)};
+}
+
+std::shared_ptr<const Light> Light::read(BinaryReader &reader)
+{
+    switch (reader.read<Type>())
+    {
+        case Type::Basic:
+            return std::shared_ptr<const Light>(new Light(reader));
+        case Type::Directional:
+            return std::make_shared<DirectionalLight>(reader);
+        case Type::Point:
+            return std::make_shared<PointLight>(reader);
+        case Type::Spot:
+            return std::make_shared<SpotLight>(reader);
+        default:
+            throw std::runtime_error("Unknown light type");
+    }
+}
+
+void Light::write(BinaryWriter &writer, Type type) const
+{
+    writer.write(type);
+    writer.write(color);
+    writer.write(baked);
+}
+
+void DirectionalLight::write(BinaryWriter &writer) const
+{
+    Light::write(writer, Type::Directional);
+    writer.write(direction);
+}
+
+void PointLight::write(BinaryWriter &writer) const
+{
+    Light::write(writer, Type::Point);
+    writer.write(intensity);
+    writer.write(range);
+    writer.write(position);
+}
+
+void SpotLight::write(BinaryWriter &writer) const
+{
+    Light::write(writer, Type::Spot);
+    writer.write(max_cos_angle);
+    writer.write(taper);
+    writer.write(direction);
+    writer.write(position);
 }
 
 Vec4 DirectionalLight::get_direction(const Vec4 &point) const
@@ -30,6 +204,14 @@ Vec4 DirectionalLight::get_direction(const Vec4 &point) const
     return direction;
 }
 
+PointLight::PointLight(Color color, float intensity, Vec4 position, float threshold)
+    : Light(color), intensity(intensity), position(position)
+{
+    // Solve intensity / distance^2 = threshold for the brightest channel of the light
+    float strength = intensity * std::max({color.r, color.g, color.b});
+    range = threshold > 0.0f && strength > 0.0f ? std::sqrt(strength / threshold) : Infinity;
+}
+
 Vec4 PointLight::get_direction(const Vec4 &point) const
 {
     return normalize(position - point);
@@ -38,7 +220,36 @@ Vec4 PointLight::get_direction(const Vec4 &point) const
 float PointLight::get_attenuation(const Vec4 &point) const
 {
     float distance_squared = magnitude_squared(position - point);
-    return intensity / distance_squared;
+
+    // Smoothly fade the light out to zero at its range instead of cutting it off
+    // https://cdn2.unrealengine.com/Resources/files/2013SiggraphPresentationsNotes-26915738.pdf
+    float ratio = distance_squared / (range * range);
+    float window = saturate(1.0f - ratio * ratio);
+    return intensity / distance_squared * window * window;
+}
+
+BoundingBox PointLight::get_bounds() const
+{
+    Vec4 extent{range, range, range, 0};
+    return {position - extent, position + extent};
+}
+
+bool PointLight::affects(const BoundingBox &box) const { return box.distance_squared(position) < range * range; }
+
+bool PointLight::is_distant(const BoundingBox &box) const
+{
+    Vec4 half = (box.high - box.low) * 0.5f;
+    half.w = 0;
+    return magnitude_squared(position - box.center()) > distant_ratio * distant_ratio * magnitude_squared(half);
+}
+
+float PointLight::estimate_strength(const BoundingBox &box) const
+{
+    // Lights inside the box are treated as if they were as far as its corners so they do not dominate
+    Vec4 half = (box.high - box.low) * 0.5f;
+    half.w = 0;
+    float distance_squared = std::max(box.distance_squared(position), magnitude_squared(half));
+    return Light::estimate_strength(box) * intensity / distance_squared;
 }
 
 Vec4 SpotLight::get_direction(const Vec4 &point) const
@@ -46,6 +257,26 @@ Vec4 SpotLight::get_direction(const Vec4 &point) const
     return normalize(position - point);
 }
 
+bool SpotLight::affects(const BoundingBox &box) const
+{
+    if (box.empty())
+        return false;
+
+    // Test the cone against a sphere around the box. https://bartwronski.com/2017/04/13/cull-that-cone/
+    Vec4 center = box.center();
+    Vec4 half = (box.high - box.low) * 0.5f;
+    float radius = std::sqrt(half.x * half.x + half.y * half.y + half.z * half.z);
+
+    Vec4 offset = center - position;
+    offset.w = 0;
+    float distance_along = -dot(offset, direction); // the stored direction points back towards the light
+    float distance_squared = magnitude_squared(offset);
+
+    float sin_angle = safe_sqrt(1.0f - max_cos_angle * max_cos_angle);
+    float closest = max_cos_angle * safe_sqrt(distance_squared - distance_along * distance_along) - distance_along * sin_angle;
+    return closest <= radius && distance_along >= -radius;
+}
+
 float SpotLight::get_attenuation(const Vec4 &point) const
 {
     float cos_angle = dot(get_direction(point), direction);
@@ -57,51 +288,85 @@ float SpotLight::get_attenuation(const Vec4 &point) const
 
 Color Material::get_color(const Vec4 &world_coord, const Vec4 &normal, const Vec3 &texture_coord, const LightCollection &lights, const Vec4 &camera) const
 {
-    Color color, diffuse_sum, specular_sum;
-    float specular_exponent = shininess;
-    if (specular_map) specular_exponent *= specular_map.get_pixel(texture_coord.x, texture_coord.y).r;
+    Color color;
+    dispatch_features(features, [&]<uint32_t Features>()
+                      { color = shade<Features>(world_coord, normal, texture_coord, lights, camera); });
+    return color;
+}
+
+void Material::classify()
+{
+    features = 0;
+    if (texture_map) features |= Textured;
+    if (specular_map) features |= SpecularMapped;
+    if (normal_map) features |= NormalMapped;
+#ifdef PHONG_MODEL
+    features |= PhongModel;
+#endif
+}
 
-    Vec4 N = normal;                          // normalized surface normal
-    Vec4 V = normalize(camera - world_coord); // normalized vector pointing from the surface to the viewer
+// Marks a texture map that the material does not use
+static constexpr uint32_t no_texture = std::numeric_limits<uint32_t>::max();
 
-    // Compute the sum of the diffuse and specular light from each light source
-    for (const auto &light : lights)
+Material::Material(BinaryReader &reader, const std::vector<std::shared_ptr<const Image>> &textures)
+{
+    shininess = reader.read<float>();
+    ambient_color = reader.read<Color>();
+    diffuse_color = reader.read<Color>();
+    specular_color = reader.read<Color>();
+
+    auto read_map = [&]() -> std::shared_ptr<const Image>
     {
-        const Color &light_color = light->get_color();
-        float attenuation = light->get_attenuation(world_coord);
+        uint32_t index = reader.read<uint32_t>();
+        if (index == no_texture)
+            return nullptr;
+        if (index >= textures.size())
+            throw std::runtime_error("Material refers to a missing texture");
+        return textures[index];
+    };
 
-        const Vec4 L = light->get_direction(world_coord); // normalized vector pointing from the surface to the light source
-        float diffuse_intensity = saturate(dot(N, L));
+    texture_map = read_map();
+    specular_map = read_map();
+    normal_map = read_map();
+    classify();
+}
 
-#ifdef PHONG_MODEL
-        specular_exponent *= 4;
-        const Vec4 R = normalize(2.0f * dot(L, N) * N - L); // normalized reflection vector
-        float angle = saturate(dot(V, R));
-#else
-        const Vec4 H = normalize(L + V);                  // normalized half vector between light and viewer directions
-        float angle = saturate(dot(N, H));
-#endif
-        float specular_intensity = std::pow(angle, specular_exponent);
+void Material::write(BinaryWriter &writer, const std::vector<std::shared_ptr<const Image>> &textures) const
+{
+    writer.write(shininess);
+    writer.write(ambient_color);
+    writer.write(diffuse_color);
+    writer.write(specular_color);
 
-        diffuse_sum  += light_color * attenuation * diffuse_intensity;
-        specular_sum += light_color * attenuation * specular_intensity;
-    }
+    auto write_map = [&](const std::shared_ptr<const Image> &map)
+    {
+        if (!map)
+        {
+            writer.write(no_texture);
+            return;
+        }
 
-    // Phong lighting model: sum of ambient, diffuse, and specular light
-    color += ambient_color * lights.get_ambient_strength();
-    color += diffuse_color * diffuse_sum;
-    color += specular_color * specular_sum;
+        auto it = std::find(textures.begin(), textures.end(), map);
+        if (it == textures.end())
+            throw std::runtime_error("Material texture is missing from the texture list");
+        writer.write(static_cast<uint32_t>(it - textures.begin()));
+    };
 
-    // Use the texture's color if there is one
-    if (texture_map) color *= texture_map.get_pixel(texture_coord.x, texture_coord.y);
+    write_map(texture_map);
+    write_map(specular_map);
+    write_map(normal_map);
+}
 
-    color.r = saturate(color.r);
-    color.g = saturate(color.g);
-    color.b = saturate(color.b);
-    return color;
+std::vector<std::shared_ptr<const Image>> Material::get_textures() const
+{
+    std::vector<std::shared_ptr<const Image>> textures;
+    for (const auto &map : {texture_map, specular_map, normal_map})
+        if (map)
+            textures.push_back(map);
+    return textures;
 }
 
-void Material::load_file(const std::string &file_name)
+void Material::load_file(const std::string &file_name, const TextureLoader &load_texture)
 {
     std::fstream file;
     std::string line;
@@ -156,7 +421,7 @@ void Material::load_file(const std::string &file_name)
             {
                 std::string path;
                 ss >> path;
-                texture_map.load_file(path);
+                texture_map = load_texture(path);
                 continue;
             }
 
@@ -164,7 +429,7 @@ void Material::load_file(const std::string &file_name)
             {
                 std::string path;
                 ss >> path;
-                specular_map.load_file(path);
+                specular_map = load_texture(path);
                 continue;
             }
 
@@ -172,7 +437,7 @@ void Material::load_file(const std::string &file_name)
             {
                 std::string path;
                 ss >> path;
-                normal_map.load_file(path);
+                normal_map = load_texture(path);
                 continue;
             }
         }
@@ -180,6 +445,8 @@ void Material::load_file(const std::string &file_name)
     }
     else
     {
-        std::cerr << "Error: Unable to open file " << file_name << std::endl;
+        throw std::runtime_error("Unable to open file " + file_name);
     }
+
+    classify();
 }
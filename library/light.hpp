@@ -17,15 +17,27 @@
 
 #pragma once
 
+#include <array>
 #include <vector>
 #include <memory>
 
 #include "vectors.hpp"
 #include "matrix.hpp"
+#include "bounds.hpp"
 #include "library.hpp"
 
 class Light;
 
+/**
+ * Loads the texture at a path. This allows materials to share the same image.
+ */
+using TextureLoader = std::function<std::shared_ptr<const Image>(const std::string &)>;
+
+/**
+ * Decodes a new copy of the texture at a path.
+ */
+std::shared_ptr<const Image> load_texture_file(const std::string &path);
+
 /**
  * A collection of lights in the scene.
  */
@@ -39,6 +51,49 @@ public:
 
     void push_back(std::shared_ptr<const Light> light) { lights.push_back(light); }
 
+    size_t size() const { return lights.size(); }
+
+    /**
+     * A light picked at random along with the factor that scales its contribution to an unbiased estimate.
+     */
+    struct Sample
+    {
+        const Light *light;
+        float weight;
+    };
+
+    /**
+     * Shades with a fixed number of randomly picked lights instead of every light in the collection.
+     * Lights are picked in proportion to their estimated strength within the box, which should bound
+     * everything shaded with this collection.
+     * @param sample_count The number of lights to shade per point, or zero to shade every light.
+     */
+    void build_sampler(size_t sample_count, const BoundingBox &box);
+
+    // Returns the number of lights shaded per point, which is zero when every light is shaded
+    size_t get_sample_count() const { return sample_count; }
+
+    /**
+     * Picks a light using the sampler from `build_sampler` in constant time.
+     */
+    Sample sample() const;
+
+    /**
+     * Moves every light that is distant from the box into a spherical harmonics approximation of
+     * the diffuse light it casts, which costs the same to evaluate no matter how many lights it holds.
+     * The lights that are moved no longer contribute any specular light.
+     * https://cseweb.ucsd.edu/~ravir/papers/envmap/envmap.pdf
+     */
+    void build_irradiance(const BoundingBox &box);
+
+    // Returns whether any lights were moved into the spherical harmonics approximation
+    bool has_irradiance() const { return irradiance_lights > 0; }
+
+    /**
+     * Evaluates the diffuse light from the lights in the spherical harmonics approximation for a surface normal.
+     */
+    Color get_irradiance(const Vec4 &normal) const;
+
     std::vector<std::shared_ptr<const Light>>::const_iterator begin() const { return lights.begin(); }
     std::vector<std::shared_ptr<const Light>>::const_iterator end() const { return lights.end(); }
 
@@ -49,6 +104,22 @@ private:
 
     // A vector of all lights in the scene.
     std::vector<std::shared_ptr<const Light>> lights;
+
+    // An alias table over the lights. https://www.keithschwarz.com/darts-dice-coins/
+    struct Bucket
+    {
+        float probability;
+        uint32_t alias;
+    };
+
+    // The irradiance from the distant lights as nine spherical harmonics coefficients
+    std::array<Color, 9> irradiance;
+    size_t irradiance_lights = 0;
+
+    size_t sample_count = 0;
+    std::vector<Bucket> buckets;
+    // The weight of each light's sample, which is one over its probability and the sample count
+    std::vector<float> weights;
 };
 
 class Light
@@ -61,8 +132,59 @@ public:
     virtual Vec4 get_direction(const Vec4 &point) const { return Vec4::ZERO; }
     virtual float get_attenuation(const Vec4 &point) const { return 1; }
 
+    /**
+     * Returns a box containing every point the light can reach, which is infinite for lights without a range.
+     */
+    virtual BoundingBox get_bounds() const { return {{-Infinity, -Infinity, -Infinity}, {Infinity, Infinity, Infinity}}; }
+
+    /**
+     * Returns false only if the light cannot reach any point in the box.
+     */
+    virtual bool affects(const BoundingBox &box) const { return true; }
+
+    /**
+     * Roughly estimates the light's strength within the box, used to pick the most important lights.
+     */
+    virtual float estimate_strength(const BoundingBox &box) const { return color.r + color.g + color.b; }
+
+    /**
+     * Returns whether the light shines in nearly the same direction and strength everywhere in the box.
+     */
+    virtual bool is_distant(const BoundingBox &box) const { return false; }
+
+    /**
+     * Baked lights never move, so their diffuse light is stored in the lightmaps of baked objects
+     * and those objects only shade them for their own lightmap.
+     */
+    bool is_baked() const { return baked; }
+    void set_baked(bool baked) { this->baked = baked; }
+
+    /**
+     * Stores the type and parameters of the light.
+     */
+    virtual void write(BinaryWriter &writer) const { write(writer, Type::Basic); }
+
+    /**
+     * Reads a light of any type stored with `write`.
+     */
+    static std::shared_ptr<const Light> read(BinaryReader &reader);
+
+protected:
+    enum class Type : uint32_t
+    {
+        Basic,
+        Directional,
+        Point,
+        Spot,
+    };
+
+    Light(BinaryReader &reader) : color(reader.read<Color>()), baked(reader.read<bool>()) {}
+
+    void write(BinaryWriter &writer, Type type) const;
+
 private:
     Color color;
+    bool baked = false;
 };
 
 /**
@@ -73,9 +195,14 @@ class DirectionalLight : public Light
 {
 public:
     DirectionalLight(Color color, Vec4 direction) : Light(color), direction(-normalize(direction)) {}
+    DirectionalLight(BinaryReader &reader) : Light(reader), direction(reader.read<Vec4>()) {}
 
     Vec4 get_direction(const Vec4 &point) const override;
 
+    bool is_distant(const BoundingBox &box) const override { return true; }
+
+    void write(BinaryWriter &writer) const override;
+
 private:
     // Stores the negative direction so that faces pointing towards the light
     // have a positive dot product.
@@ -88,13 +215,39 @@ private:
 class PointLight : public Light
 {
 public:
-    PointLight(Color color, float intensity, Vec4 position) : Light(color), intensity(intensity), position(position) {}
+    /**
+     * The default strength below which a light is treated as having no effect.
+     */
+    static constexpr float default_threshold = 1E-3f;
+
+    /**
+     * @param threshold The light is cut off at the distance where its strength falls below this value.
+     */
+    PointLight(Color color, float intensity, Vec4 position, float threshold = default_threshold);
+    PointLight(BinaryReader &reader) : Light(reader), intensity(reader.read<float>()), range(reader.read<float>()), position(reader.read<Vec4>()) {}
 
     Vec4 get_direction(const Vec4 &point) const override;
     float get_attenuation(const Vec4 &point) const override;
 
+    BoundingBox get_bounds() const override;
+    bool affects(const BoundingBox &box) const override;
+
+    float estimate_strength(const BoundingBox &box) const override;
+
+    /**
+     * The light is distant once it is this many times further from the center of the box than the box's corners.
+     */
+    static constexpr float distant_ratio = 10.0f;
+
+    bool is_distant(const BoundingBox &box) const override;
+
+    // Returns the distance past which the light has no effect
+    float get_range() const { return range; }
+
+    void write(BinaryWriter &writer) const override;
+
 private:
-    float intensity;
+    float intensity, range;
     Vec4 position;
 };
 
@@ -105,10 +258,15 @@ class SpotLight : public Light
 {
 public:
     SpotLight(Color color, float angle, float taper, Vec4 direction, Vec4 position) : Light(color), max_cos_angle(std::cos(angle)), taper(taper), direction(-normalize(direction)), position(position) {}
+    SpotLight(BinaryReader &reader) : Light(reader), max_cos_angle(reader.read<float>()), taper(reader.read<float>()), direction(reader.read<Vec4>()), position(reader.read<Vec4>()) {}
 
     Vec4 get_direction(const Vec4 &point) const override;
     float get_attenuation(const Vec4 &point) const override;
 
+    bool affects(const BoundingBox &box) const override;
+
+    void write(BinaryWriter &writer) const override;
+
 private:
     float max_cos_angle, taper;
     Vec4 direction;
@@ -121,8 +279,33 @@ private:
 class Material
 {
 public:
-    Material() : shininess{0}, ambient_color{0}, diffuse_color{0}, specular_color{0} {}
-    Material(const std::string &file_name) { load_file(file_name); }
+    /**
+     * The optional parts of the shading model that a material uses.
+     * Each combination is compiled into its own shader, so unused features cost nothing per pixel.
+     */
+    enum Feature : uint32_t
+    {
+        Textured = 1 << 0,
+        SpecularMapped = 1 << 1,
+        NormalMapped = 1 << 2,
+        PhongModel = 1 << 3,
+        AllFeatures = (1 << 4) - 1,
+    };
+
+    Material() : shininess{0}, ambient_color{0}, diffuse_color{0}, specular_color{0} { classify(); }
+    Material(const std::string &file_name, const TextureLoader &load_texture = load_texture_file) { load_file(file_name, load_texture); }
+
+    /**
+     * Reads a material stored with `write`.
+     * @param textures The textures that the stored texture indices refer to.
+     */
+    Material(BinaryReader &reader, const std::vector<std::shared_ptr<const Image>> &textures);
+
+    /**
+     * Stores the material, referring to its texture maps by their index in `textures`.
+     * Every texture returned by `get_textures` must be in the list.
+     */
+    void write(BinaryWriter &writer, const std::vector<std::shared_ptr<const Image>> &textures) const;
 
     /**
      * Calculates the color at a point using the Blinn-Phong reflection model
@@ -130,16 +313,134 @@ public:
      */
     Color get_color(const Vec4 &world_coord, const Vec4 &normal, const Vec3 &texture_coord, const LightCollection &lights, const Vec4 &camera) const;
 
+    /**
+     * Calculates the color at a point with the material's features known at compile time.
+     * `Features` must only contain features from `get_features`, which `dispatch_features` takes care of.
+     * Leaving a feature out skips it, such as the texture when it is applied later.
+     * @param irradiance Diffuse light from lights that are not in the collection, such as a lightmap sample.
+     */
+    template <uint32_t Features>
+    Color shade(const Vec4 &world_coord, const Vec4 &normal, const Vec3 &texture_coord, const LightCollection &lights, const Vec4 &camera, const Color &irradiance = Color()) const;
+
+    // Returns the bitmask of features used by this material
+    uint32_t get_features() const { return features; }
+
     Color get_ambient() const { return ambient_color; }
     Color get_diffuse() const { return diffuse_color; }
     Color get_specular() const { return specular_color; }
 
-    const Image &get_normal_map() const { return normal_map; }
+    // Returns the texture map, or null if the material does not have one
+    const Image *get_texture_map() const { return texture_map.get(); }
+
+    // Returns the normal map, or null if the material does not have one
+    const Image *get_normal_map() const { return normal_map.get(); }
+
+    // Returns every texture map used by the material
+    std::vector<std::shared_ptr<const Image>> get_textures() const;
+
+    /**
+     * Returns the number of bytes used by this material.
+     * Textures are shared between materials and are not included.
+     */
+    size_t memory_size() const { return sizeof(Material); }
 
 private:
-    void load_file(const std::string &file_name);
+    void load_file(const std::string &file_name, const TextureLoader &load_texture);
+
+    // Sets the feature bitmask from the loaded texture maps
+    void classify();
 
     float shininess;
     Color ambient_color, diffuse_color, specular_color;
-    Image texture_map, specular_map, normal_map;
+    std::shared_ptr<const Image> texture_map, specular_map, normal_map;
+    uint32_t features;
 };
+
+/**
+ * Calls `action.template operator()<Features>()` with a runtime feature bitmask turned into a compile time constant.
+ * This lets a whole draw call be specialized for a material instead of checking its features for every pixel.
+ */
+template <uint32_t Features = 0, typename F>
+void dispatch_features(uint32_t features, F &&action)
+{
+    if constexpr (Features <= Material::AllFeatures)
+    {
+        if (features == Features)
+            action.template operator()<Features>();
+        else
+            dispatch_features<Features + 1>(features, action);
+    }
+}
+
+template <uint32_t Features>
+Color Material::shade(const Vec4 &world_coord, const Vec4 &normal, const Vec3 &texture_coord, const LightCollection &lights, const Vec4 &camera, const Color &irradiance) const
+{
+    // Start from the diffuse light that was already computed, such as from a lightmap
+    Color color, diffuse_sum = irradiance, specular_sum;
+    float specular_exponent = shininess;
+    if constexpr ((Features & SpecularMapped) != 0)
+        specular_exponent *= specular_map->get_pixel(texture_coord.x, texture_coord.y).r;
+    // The reflection vector spreads highlights wider than the half vector, so sharpen them to match
+    if constexpr ((Features & PhongModel) != 0)
+        specular_exponent *= 4;
+
+    Vec4 N = normal;                          // normalized surface normal
+    Vec4 V = normalize(camera - world_coord); // normalized vector pointing from the surface to the viewer
+
+    // Compute the sum of the diffuse and specular light from each light source
+    auto add_light = [&](const Light &light, float weight)
+    {
+        const Color &light_color = light.get_color();
+        float attenuation = light.get_attenuation(world_coord) * weight;
+
+        const Vec4 L = light.get_direction(world_coord); // normalized vector pointing from the surface to the light source
+        float diffuse_intensity = saturate(dot(N, L));
+
+        float angle;
+        if constexpr ((Features & PhongModel) != 0)
+        {
+            const Vec4 R = normalize(2.0f * dot(L, N) * N - L); // normalized reflection vector
+            angle = saturate(dot(V, R));
+        }
+        else
+        {
+            const Vec4 H = normalize(L + V); // normalized half vector between light and viewer directions
+            angle = saturate(dot(N, H));
+        }
+        float specular_intensity = std::pow(angle, specular_exponent);
+
+        diffuse_sum  += light_color * attenuation * diffuse_intensity;
+        specular_sum += light_color * attenuation * specular_intensity;
+    };
+
+    if (lights.has_irradiance())
+        diffuse_sum += lights.get_irradiance(N);
+
+    if (lights.get_sample_count() > 0)
+    {
+        for (size_t i = 0; i < lights.get_sample_count(); ++i)
+        {
+            LightCollection::Sample sample = lights.sample();
+            add_light(*sample.light, sample.weight);
+        }
+    }
+    else
+    {
+        for (const auto &light : lights)
+            add_light(*light, 1.0f);
+    }
+
+    // Phong lighting model: sum of ambient, diffuse, and specular light
+    color += ambient_color * lights.get_ambient_strength();
+    color += diffuse_color * diffuse_sum;
+    color += specular_color * specular_sum;
+
+    // Use the texture's color if there is one
+    if constexpr ((Features & Textured) != 0)
+        color *= texture_map->get_pixel(texture_coord.x, texture_coord.y);
+
+    color.r = saturate(color.r);
+    color.g = saturate(color.g);
+    color.b = saturate(color.b);
+    return color;
+}
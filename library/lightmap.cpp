@@ -0,0 +1,85 @@
+/* This file is part of the Michigan Computer Graphics rasterization workshop.
+ * Copyright (C) 2025  Aidan Rhys Donley
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "lightmap.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+Image bake_lightmap(const Mesh &mesh, const Matrix4 &m_model, const LightCollection &lights)
+{
+    if (!mesh.has_lightmap_coordinates())
+        throw std::runtime_error("Cannot bake a lightmap for a mesh without lightmap coordinates");
+
+    uint32_t resolution = mesh.get_lightmap_resolution();
+    uint32_t cell_size = mesh.get_lightmap_cell_size();
+    uint32_t cells = resolution / cell_size;
+    Image lightmap(resolution, resolution);
+
+    auto bake_triangle = [&](uint32_t t)
+    {
+        Triplet triangle = mesh[t];
+
+        Vec4 world[3], normal[3];
+        Vec3 texel[3];
+        for (int k = 0; k < 3; ++k)
+        {
+            world[k] = m_model * mesh.get_vertex(triangle[k]);
+            normal[k] = m_model * mesh.get_normal(triangle[k]);
+            texel[k] = mesh.get_lightmap_coordinates(triangle[k]) * static_cast<float>(resolution);
+        }
+
+        float area = (texel[1].x - texel[0].x) * (texel[2].y - texel[0].y) - (texel[2].x - texel[0].x) * (texel[1].y - texel[0].y);
+
+        // Every texel in the triangle's half of its cell belongs to it, including the
+        // margins around it, so that sampling near an edge never reads an empty texel
+        uint32_t cell_x = (t / 2) % cells * cell_size, cell_y = (t / 2) / cells * cell_size;
+        bool upper = t % 2 == 1;
+
+        for (uint32_t y = 0; y < cell_size; ++y)
+        {
+            for (uint32_t x = 0; x < cell_size; ++x)
+            {
+                if ((x + y + 1 >= cell_size) != upper)
+                    continue;
+
+                // Find the barycentric coordinates of the texel's center, clamped onto the triangle
+                float px = cell_x + x + 0.5f, py = cell_y + y + 0.5f;
+                float b = ((texel[0].x - texel[2].x) * (py - texel[2].y) - (px - texel[2].x) * (texel[0].y - texel[2].y)) / area;
+                float c = ((texel[1].x - texel[0].x) * (py - texel[0].y) - (px - texel[0].x) * (texel[1].y - texel[0].y)) / area;
+                float a = 1 - b - c;
+                a = std::max(a, 0.0f), b = std::max(b, 0.0f), c = std::max(c, 0.0f);
+                float sum = a + b + c;
+                a /= sum, b /= sum, c /= sum;
+
+                Vec4 point = world[0] * a + world[1] * b + world[2] * c;
+                Vec4 N = normalize(normal[0] * a + normal[1] * b + normal[2] * c);
+
+                // The diffuse part of the lighting in `Material::shade`
+                Color irradiance;
+                for (const auto &light : lights)
+                    irradiance += light->get_color() * (light->get_attenuation(point) * saturate(dot(N, light->get_direction(point))));
+
+                lightmap.set_pixel(cell_x + x, cell_y + y, irradiance);
+            }
+        }
+    };
+
+    parallel_for(0, mesh.size(), bake_triangle, false);
+
+    return lightmap;
+}
@@ -0,0 +1,33 @@
+/* This file is part of the Michigan Computer Graphics rasterization workshop.
+ * Copyright (C) 2025  Aidan Rhys Donley
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "mesh.hpp"
+#include "light.hpp"
+#include "matrix.hpp"
+#include "library.hpp"
+
+/**
+ * Computes the diffuse light that reaches each texel of an object's lightmap.
+ * The lightmap stores the light before it is multiplied by the material's diffuse color,
+ * so it can be passed straight to `Material::shade` as the surface's irradiance.
+ * @param mesh A mesh with lightmap coordinates, see `Mesh::with_lightmap_coordinates`.
+ * @param m_model The model matrix that places the mesh in the world.
+ * @param lights The lights to bake. Every light is evaluated, even if the collection is sampled.
+ */
+Image bake_lightmap(const Mesh &mesh, const Matrix4 &m_model, const LightCollection &lights);
@@ -16,9 +16,15 @@
  */
 
 #include "mesh.hpp"
+#include "matrix.hpp"
 
+#include "../thirdparty/fkYAML/node.hpp"
+
+#include <algorithm>
+#include <cstring>
 #include <fstream>
 #include <iostream>
+#include <stdexcept>
 
 std::ostream &operator<<(std::ostream &os, const Triplet &rhs)
 {
@@ -33,18 +39,18 @@ void remove_duplicates(std::vector<std::string> &arr)
     arr.erase(std::unique(arr.begin(), arr.end()), arr.end());
 }
 
-void Mesh::smooth_normals()
+void Mesh::smooth_normals(const std::vector<Vec4> &positions, std::vector<Vec4> &normals, size_t first_vertex, size_t first_triangle) const
 {
-    for (size_t i = 0; i < normals.size(); ++i)
+    for (size_t i = first_vertex; i < normals.size(); ++i)
         normals[i].w = 0;
 
-    for (size_t i = 0; i < size(); ++i)
+    for (size_t i = first_triangle; i < size(); ++i)
     {
         Triplet tri = at(i);
         // Compute the normal of each face and add it to the normal of each vertex
 
-        Vec4 edge1 = vertices[tri[1]] - vertices[tri[0]];
-        Vec4 edge2 = vertices[tri[2]] - vertices[tri[0]];
+        Vec4 edge1 = positions[tri[1]] - positions[tri[0]];
+        Vec4 edge2 = positions[tri[2]] - positions[tri[0]];
         Vec4 normal = cross(edge1, edge2);
 
         normals[tri[0]] += normal;
@@ -52,18 +58,380 @@ void Mesh::smooth_normals()
         normals[tri[2]] += normal;
     }
 
-    for (size_t i = 0; i < normals.size(); ++i)
+    for (size_t i = first_vertex; i < normals.size(); ++i)
         normals[i] = normalize(normals[i]);
 }
 
+// Returns -1 for negative values and 1 otherwise
+static float sign_not_zero(float value) { return value < 0.0f ? -1.0f : 1.0f; }
+
+static int16_t to_snorm(float value) { return static_cast<int16_t>(std::round(std::clamp(value, -1.0f, 1.0f) * 32767.0f)); }
+
+static float from_snorm(int16_t value) { return std::max(value / 32767.0f, -1.0f); }
+
+// Builds two directions that form an orthonormal basis with a unit normal. https://jcgt.org/published/0006/01/01/
+static void orthonormal_basis(const Vec4 &normal, Vec4 &b1, Vec4 &b2)
+{
+    float sign = std::copysign(1.0f, normal.z);
+    float a = -1.0f / (sign + normal.z);
+    float b = normal.x * normal.y * a;
+    b1 = {1.0f + sign * normal.x * normal.x * a, sign * b, -sign * normal.x, 0};
+    b2 = {b, sign + normal.y * normal.y * a, -normal.y, 0};
+}
+
+std::vector<Vec4> Mesh::compute_tangents(const std::vector<Vec4> &positions, const std::vector<Vec4> &normals, const std::vector<Vec3> &textures) const
+{
+    std::vector<Vec4> tangents(positions.size(), Vec4(0, 0, 0, 0));
+    std::vector<Vec4> bitangents(positions.size(), Vec4(0, 0, 0, 0));
+
+    // Sum the texture space directions of each face at its vertices
+    for (size_t i = 0; i < size(); ++i)
+    {
+        Triplet tri = at(i);
+
+        Vec4 edge1 = positions[tri[1]] - positions[tri[0]];
+        Vec4 edge2 = positions[tri[2]] - positions[tri[0]];
+        Vec3 uv1 = textures[tri[1]] - textures[tri[0]];
+        Vec3 uv2 = textures[tri[2]] - textures[tri[0]];
+
+        float det = uv1.x * uv2.y - uv2.x * uv1.y;
+        if (almost_zero(det))
+            continue;
+        float r = 1.0f / det;
+
+        Vec4 tangent = (edge1 * uv2.y - edge2 * uv1.y) * r;
+        Vec4 bitangent = (edge2 * uv1.x - edge1 * uv2.x) * r;
+        tangent.w = bitangent.w = 0;
+
+        for (size_t j = 0; j < 3; ++j)
+        {
+            tangents[tri[j]] += tangent;
+            bitangents[tri[j]] += bitangent;
+        }
+    }
+
+    for (size_t i = 0; i < tangents.size(); ++i)
+    {
+        const Vec4 &n = normals[i];
+
+        // Make the tangent orthogonal to the normal, falling back to any direction if the texture is degenerate
+        Vec4 t = tangents[i] - n * dot(n, tangents[i]);
+        if (almost_zero(magnitude_squared(t)))
+        {
+            Vec4 b2;
+            orthonormal_basis(n, t, b2);
+        }
+        t = normalize(t);
+
+        t.w = dot(cross(n, t), bitangents[i]) < 0.0f ? -1.0f : 1.0f;
+        tangents[i] = t;
+    }
+
+    return tangents;
+}
+
+void Mesh::pack(const std::vector<Vec4> &positions, const std::vector<Vec4> &normals, const std::vector<Vec3> &textures)
+{
+    std::vector<Vec4> tangents = compute_tangents(positions, normals, textures);
+
+    position_offset = bounds.low;
+    position_scale = (bounds.high - bounds.low) / 65535.0f;
+
+    auto quantize = [](float value, float offset, float scale)
+    {
+        if (scale <= 0.0f)
+            return uint16_t{0};
+        return static_cast<uint16_t>(std::clamp(std::round((value - offset) / scale), 0.0f, 65535.0f));
+    };
+
+    vertices.resize(positions.size());
+    for (size_t i = 0; i < positions.size(); ++i)
+    {
+        PackedVertex &vertex = vertices[i];
+        const Vec4 &p = positions[i];
+        vertex.position[0] = quantize(p.x, position_offset.x, position_scale.x);
+        vertex.position[1] = quantize(p.y, position_offset.y, position_scale.y);
+        vertex.position[2] = quantize(p.z, position_offset.z, position_scale.z);
+
+        // Project the normal onto an octahedron and unfold the lower half over the upper half
+        const Vec4 &n = normals[i];
+        float length = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+        float u = 0, v = 0;
+        if (length > 0.0f)
+        {
+            u = n.x / length;
+            v = n.y / length;
+            if (n.z < 0.0f)
+            {
+                float folded_u = (1.0f - std::abs(v)) * sign_not_zero(u);
+                float folded_v = (1.0f - std::abs(u)) * sign_not_zero(v);
+                u = folded_u;
+                v = folded_v;
+            }
+        }
+        vertex.normal[0] = to_snorm(u);
+        vertex.normal[1] = to_snorm(v);
+
+        vertex.texture[0] = float_to_half(textures[i].x);
+        vertex.texture[1] = float_to_half(textures[i].y);
+
+        // Measure the tangent's angle against a basis built from the decoded normal, which the reader also uses
+        Vec4 b1, b2;
+        orthonormal_basis(get_normal(i), b1, b2);
+        const Vec4 &t = tangents[i];
+        float angle = std::atan2(dot(t, b2), dot(t, b1)) / Pi;
+        auto bits = static_cast<uint16_t>(std::round((angle * 0.5f + 0.5f) * 32767.0f));
+        vertex.tangent = bits | (t.w < 0.0f ? 0x8000 : 0);
+    }
+}
+
+Vec4 Mesh::get_vertex(size_t i) const
+{
+    const PackedVertex &vertex = vertices[i];
+    return {
+        position_offset.x + vertex.position[0] * position_scale.x,
+        position_offset.y + vertex.position[1] * position_scale.y,
+        position_offset.z + vertex.position[2] * position_scale.z,
+        1,
+    };
+}
+
+Vec3 Mesh::get_texture(size_t i) const
+{
+    const PackedVertex &vertex = vertices[i];
+    return {half_to_float(vertex.texture[0]), half_to_float(vertex.texture[1])};
+}
+
+Vec4 Mesh::get_normal(size_t i) const
+{
+    const PackedVertex &vertex = vertices[i];
+    float x = from_snorm(vertex.normal[0]);
+    float y = from_snorm(vertex.normal[1]);
+    float z = 1.0f - std::abs(x) - std::abs(y);
+
+    // Fold the lower half of the octahedron back out
+    float t = std::max(-z, 0.0f);
+    x += x >= 0.0f ? -t : t;
+    y += y >= 0.0f ? -t : t;
+
+    return normalize(Vec4{x, y, z, 0});
+}
+
+Vec4 Mesh::get_tangent(size_t i) const
+{
+    uint16_t bits = vertices[i].tangent;
+    float angle = ((bits & 0x7FFF) / 32767.0f * 2.0f - 1.0f) * Pi;
+
+    Vec4 b1, b2;
+    orthonormal_basis(get_normal(i), b1, b2);
+    Vec4 tangent = b1 * std::cos(angle) + b2 * std::sin(angle);
+    tangent.w = bits & 0x8000 ? -1.0f : 1.0f;
+    return tangent;
+}
+
+size_t Mesh::memory_size() const
+{
+    return sizeof(Mesh) +
+           vertices.capacity() * sizeof(PackedVertex) +
+           elements.capacity() * sizeof(uint32_t) +
+           meshlets.capacity() * sizeof(Meshlet) +
+           meshlet_vertices.capacity() * sizeof(uint32_t) +
+           lightmap_coordinates.capacity() * sizeof(uint16_t);
+}
+
+Mesh Mesh::with_lightmap_coordinates(uint32_t texels) const
+{
+    Mesh mesh = *this;
+
+    // Give every corner of every triangle its own vertex
+    mesh.vertices.resize(count * 3);
+    for (size_t i = 0; i < count * 3; ++i)
+    {
+        mesh.vertices[i] = vertices[elements[i]];
+        mesh.elements[i] = static_cast<uint32_t>(i);
+    }
+
+    // Two triangles fit in each cell of a square grid
+    uint32_t cells = static_cast<uint32_t>(std::ceil(std::sqrt((count + 1) / 2)));
+    cells = std::max(cells, 1u);
+    texels = std::clamp(texels, 2u, std::max(max_lightmap_resolution / cells, 2u));
+    mesh.lightmap_resolution = cells * texels;
+    mesh.lightmap_cell_size = texels;
+
+    // Keep half a texel between triangles so that sampling a triangle's edge never reads its neighbour
+    float cell = 1.0f / cells;
+    float margin = 0.5f / mesh.lightmap_resolution;
+
+    auto to_unorm = [](float value) { return static_cast<uint16_t>(std::round(std::clamp(value, 0.0f, 1.0f) * 65535.0f)); };
+
+    mesh.lightmap_coordinates.resize(count * 6);
+    for (size_t i = 0; i < count; ++i)
+    {
+        float x0 = (i / 2 % cells) * cell, y0 = (i / 2 / cells) * cell;
+        float x1 = x0 + cell, y1 = y0 + cell;
+
+        // The first triangle takes the lower left half of the cell and the second takes the upper right
+        Vec3 corners[3];
+        if (i % 2 == 0)
+        {
+            corners[0] = {x0 + margin, y0 + margin};
+            corners[1] = {x1 - 3 * margin, y0 + margin};
+            corners[2] = {x0 + margin, y1 - 3 * margin};
+        }
+        else
+        {
+            corners[0] = {x1 - margin, y1 - margin};
+            corners[1] = {x0 + 3 * margin, y1 - margin};
+            corners[2] = {x1 - margin, y0 + 3 * margin};
+        }
+
+        for (size_t k = 0; k < 3; ++k)
+        {
+            mesh.lightmap_coordinates[(i * 3 + k) * 2] = to_unorm(corners[k].x);
+            mesh.lightmap_coordinates[(i * 3 + k) * 2 + 1] = to_unorm(corners[k].y);
+        }
+    }
+
+    mesh.build_meshlets();
+    return mesh;
+}
+
+bool Meshlet::is_visible(const Frustum &frustum, const Vec4 &camera) const
+{
+    if (!frustum.intersects(bounds))
+        return false;
+
+    if (cone_cutoff >= 1.0f)
+        return true;
+
+    Vec4 view = normalize(cone_apex - camera);
+    return dot(view, cone_axis) < cone_cutoff;
+}
+
+void Mesh::build_meshlets()
+{
+    meshlets.clear();
+    meshlet_vertices.clear();
+
+    // Maps a vertex to the meshlet it was last added to
+    std::vector<uint32_t> owner(vertex_size(), std::numeric_limits<uint32_t>::max());
+
+    auto compute_bounds = [&](Meshlet &meshlet)
+    {
+        // Use the center of the bounding box as the center of the sphere
+        BoundingBox box;
+        for (uint32_t i = 0; i < meshlet.vertex_count; ++i)
+            box.expand(get_vertex(meshlet_vertices[meshlet.vertex_offset + i]));
+
+        Vec4 center = box.center();
+
+        float radius = 0;
+        for (uint32_t i = 0; i < meshlet.vertex_count; ++i)
+            radius = std::max(radius, magnitude(get_vertex(meshlet_vertices[meshlet.vertex_offset + i]) - center));
+
+        meshlet.bounds = {center, radius};
+
+        // Average the face normals to find the axis of the normal cone
+        // https://github.com/zeux/meshoptimizer/blob/master/src/clusterizer.cpp
+        std::vector<std::pair<Vec4, Vec4>> faces; // a point on each face and its normal
+        Vec4 axis = Vec4::ZERO;
+        for (uint32_t i = 0; i < meshlet.triangle_count; ++i)
+        {
+            Triplet tri = at(meshlet.triangle_offset + i);
+            Vec4 p0 = get_vertex(tri[0]), p1 = get_vertex(tri[1]), p2 = get_vertex(tri[2]);
+            Vec4 normal = normalize(cross(p1 - p0, p2 - p0));
+
+            // Degenerate triangles do not face any direction
+            if (magnitude_squared(normal) == 0)
+                continue;
+
+            faces.emplace_back(p0, normal);
+            axis += normal;
+        }
+        axis = normalize(axis);
+
+        meshlet.cone_apex = center;
+        meshlet.cone_axis = axis;
+        meshlet.cone_cutoff = 1;
+
+        float min_dot = 1;
+        for (const auto &[point, normal] : faces)
+            min_dot = std::min(min_dot, dot(axis, normal));
+
+        // The cone is too wide to ever be entirely back facing
+        if (faces.empty() || min_dot <= 0.1f)
+            return;
+
+        // Move the apex back until every triangle's plane is in front of it
+        float max_t = 0;
+        for (const auto &[point, normal] : faces)
+            max_t = std::max(max_t, dot(center - point, normal) / dot(axis, normal));
+
+        meshlet.cone_apex = center - axis * max_t;
+        meshlet.cone_cutoff = std::sqrt(1 - min_dot * min_dot);
+    };
+
+    Meshlet current{};
+
+    for (size_t i = 0; i < size(); ++i)
+    {
+        Triplet tri = at(i);
+        auto current_index = static_cast<uint32_t>(meshlets.size());
+
+        uint32_t added = 0;
+        for (size_t j = 0; j < 3; ++j)
+            if (owner[tri[j]] != current_index)
+                ++added;
+
+        // Start a new meshlet when this triangle does not fit
+        if (current.vertex_count + added > Meshlet::max_vertices || current.triangle_count + 1 > Meshlet::max_triangles)
+        {
+            compute_bounds(current);
+            meshlets.push_back(current);
+
+            current = {};
+            current.vertex_offset = static_cast<uint32_t>(meshlet_vertices.size());
+            current.triangle_offset = static_cast<uint32_t>(i);
+            ++current_index;
+        }
+
+        for (size_t j = 0; j < 3; ++j)
+        {
+            if (owner[tri[j]] == current_index)
+                continue;
+            owner[tri[j]] = current_index;
+            meshlet_vertices.push_back(tri[j]);
+            ++current.vertex_count;
+        }
+        ++current.triangle_count;
+    }
+
+    if (current.triangle_count > 0)
+    {
+        compute_bounds(current);
+        meshlets.push_back(current);
+    }
+}
+
 void Mesh::load_file(const std::string &file_name)
 {
+    if (file_name.ends_with(".glb"))
+    {
+        load_glb(file_name);
+        return;
+    }
+
     count = 0;
 
     std::vector<Vec4> cached_vertices;
     std::vector<Vec3> cached_textures;
     std::vector<Vec4> cached_normals;
 
+    // Full precision attributes that are packed once the file is read
+    std::vector<Vec4> positions;
+    std::vector<Vec4> normals;
+    std::vector<Vec3> textures;
+
     std::vector<std::string> faces;
     std::vector<std::string> corrected_index_mapping;
 
@@ -155,7 +523,7 @@ void Mesh::load_file(const std::string &file_name)
 
         bool has_normals = !normals.empty();
 
-        vertices.resize(index_count);
+        positions.resize(index_count);
         textures.resize(index_count);
         normals.resize(index_count);
 
@@ -166,7 +534,7 @@ void Mesh::load_file(const std::string &file_name)
 
             int vertex_index;
             ess >> vertex_index;
-            vertices[i] = cached_vertices[vertex_index - 1];
+            positions[i] = cached_vertices[vertex_index - 1];
 
             if (!ess.eof() && ess.peek() == '/')
             {
@@ -230,12 +598,406 @@ void Mesh::load_file(const std::string &file_name)
         }
 
         if (!has_normals)
-            smooth_normals();
+            smooth_normals(positions, normals);
+
+        bounds = {};
+        for (const Vec4 &position : positions)
+            bounds.expand(position);
+
+        pack(positions, normals, textures);
+        build_meshlets();
     }
     else
     {
-        std::cerr << "Error: Unable to open file " << file_name << std::endl;
+        throw std::runtime_error("Unable to open file " + file_name);
+    }
+}
+
+/**
+ * A typed view into the binary chunk of a glTF file.
+ */
+struct GLTFAccessor
+{
+    const uint8_t *data = nullptr;
+    size_t count = 0, stride = 0;
+    uint32_t component_type = 0, components = 0;
+    bool normalized = false;
+
+    explicit operator bool() const { return data != nullptr; }
+};
+
+// glTF component types
+static constexpr uint32_t gltf_byte = 5120;
+static constexpr uint32_t gltf_unsigned_byte = 5121;
+static constexpr uint32_t gltf_short = 5122;
+static constexpr uint32_t gltf_unsigned_short = 5123;
+static constexpr uint32_t gltf_unsigned_int = 5125;
+static constexpr uint32_t gltf_float = 5126;
+
+static size_t get_component_size(uint32_t type)
+{
+    switch (type)
+    {
+        case gltf_byte:
+        case gltf_unsigned_byte:
+            return 1;
+        case gltf_short:
+        case gltf_unsigned_short:
+            return 2;
+        case gltf_unsigned_int:
+        case gltf_float:
+            return 4;
+        default:
+            throw std::runtime_error("Unsupported glTF component type");
+    }
+}
+
+template <typename T>
+static T load(const uint8_t *data)
+{
+    // glTF data is only aligned to its component size, so read through memcpy
+    T value;
+    std::memcpy(&value, data, sizeof(T));
+    return value;
+}
+
+// Reads a component of an element, converting normalized integers into [0, 1] or [-1, 1]
+static float get_float(const GLTFAccessor &accessor, size_t i, uint32_t component)
+{
+    const uint8_t *element = accessor.data + i * accessor.stride + component * get_component_size(accessor.component_type);
+    bool normalized = accessor.normalized;
+    switch (accessor.component_type)
+    {
+        case gltf_float:
+            return load<float>(element);
+        case gltf_unsigned_byte:
+            return normalized ? load<uint8_t>(element) / 255.0f : load<uint8_t>(element);
+        case gltf_unsigned_short:
+            return normalized ? load<uint16_t>(element) / 65535.0f : load<uint16_t>(element);
+        case gltf_byte:
+            return normalized ? std::max(load<int8_t>(element) / 127.0f, -1.0f) : load<int8_t>(element);
+        case gltf_short:
+            return normalized ? std::max(load<int16_t>(element) / 32767.0f, -1.0f) : load<int16_t>(element);
+        default:
+            throw std::runtime_error("Unsupported glTF attribute type");
+    }
+}
+
+// Reads an element of an index accessor
+static uint32_t get_index(const GLTFAccessor &accessor, size_t i)
+{
+    const uint8_t *element = accessor.data + i * accessor.stride;
+    switch (accessor.component_type)
+    {
+        case gltf_unsigned_byte:
+            return load<uint8_t>(element);
+        case gltf_unsigned_short:
+            return load<uint16_t>(element);
+        case gltf_unsigned_int:
+            return load<uint32_t>(element);
+        default:
+            throw std::runtime_error("Unsupported glTF index type");
+    }
+}
+
+static uint32_t get_component_count(const std::string &type)
+{
+    if (type == "SCALAR")
+        return 1;
+    if (type == "VEC2")
+        return 2;
+    if (type == "VEC3")
+        return 3;
+    if (type == "VEC4")
+        return 4;
+    throw std::runtime_error("Unsupported glTF accessor type " + type);
+}
+
+static size_t get_size(const fkyaml::node &node, const std::string &key, size_t fallback = 0)
+{
+    return node.contains(key) ? node[key].get_value<size_t>() : fallback;
+}
+
+static GLTFAccessor get_accessor(const fkyaml::node &root, size_t index, const uint8_t *binary, size_t binary_size)
+{
+    const fkyaml::node &node = root["accessors"][index];
+    if (!node.contains("bufferView"))
+        throw std::runtime_error("Sparse glTF accessors are not supported");
+
+    const fkyaml::node &view = root["bufferViews"][get_size(node, "bufferView")];
+    if (get_size(view, "buffer") != 0 || binary == nullptr)
+        throw std::runtime_error("glTF data must be stored in the binary chunk");
+
+    GLTFAccessor accessor;
+    accessor.count = get_size(node, "count");
+    accessor.component_type = static_cast<uint32_t>(get_size(node, "componentType"));
+    accessor.components = get_component_count(node["type"].as_str());
+    accessor.normalized = node.contains("normalized") && node["normalized"].get_value<bool>();
+
+    size_t element_size = get_component_size(accessor.component_type) * accessor.components;
+    accessor.stride = get_size(view, "byteStride", element_size);
+
+    size_t view_offset = get_size(view, "byteOffset");
+    size_t view_length = get_size(view, "byteLength");
+    size_t offset = get_size(node, "byteOffset");
+    if (view_offset + view_length > binary_size ||
+        (accessor.count > 0 && offset + (accessor.count - 1) * accessor.stride + element_size > view_length))
+        throw std::runtime_error("glTF accessor is out of bounds");
+
+    accessor.data = binary + view_offset + offset;
+    return accessor;
+}
+
+// Reads a number that JSON may have written without a fractional part
+static float get_number(const fkyaml::node &node)
+{
+    return node.is_integer() ? static_cast<float>(node.get_value<int64_t>()) : node.get_value<float>();
+}
+
+// Reads the local transform of a node, stored either as a matrix or as a translation, rotation, and scale
+static Matrix4 get_node_matrix(const fkyaml::node &node)
+{
+    Matrix4 matrix = Matrix4::Identity;
+    if (node.contains("matrix"))
+    {
+        // glTF matrices are column major like Matrix4
+        const fkyaml::node &values = node["matrix"];
+        if (values.size() != 16)
+            throw std::runtime_error("glTF node matrix must have 16 values");
+        for (size_t i = 0; i < 16; ++i)
+            matrix.at(i % 4, i / 4) = get_number(values[i]);
+        return matrix;
+    }
+
+    if (node.contains("translation"))
+    {
+        const fkyaml::node &t = node["translation"];
+        matrix = matrix * translate(Vec3{get_number(t[0]), get_number(t[1]), get_number(t[2])});
+    }
+    if (node.contains("rotation"))
+    {
+        // glTF stores the quaternion as x, y, z, w
+        const fkyaml::node &r = node["rotation"];
+        matrix = matrix * rotate(Quaternion(get_number(r[3]), get_number(r[0]), get_number(r[1]), get_number(r[2])));
+    }
+    if (node.contains("scale"))
+    {
+        const fkyaml::node &s = node["scale"];
+        matrix = matrix * scale(Vec3{get_number(s[0]), get_number(s[1]), get_number(s[2])});
+    }
+    return matrix;
+}
+
+void Mesh::load_glb(const std::string &file_name)
+{
+    constexpr uint32_t glb_magic = 0x46546C67;  // "glTF"
+    constexpr uint32_t json_chunk = 0x4E4F534A; // "JSON"
+    constexpr uint32_t binary_chunk = 0x004E4942; // "BIN\0"
+
+    MappedFile file(file_name);
+    const uint8_t *data = file.data();
+
+    if (file.size() < 12 || load<uint32_t>(data) != glb_magic || load<uint32_t>(data + 4) != 2)
+        throw std::runtime_error("Not a binary glTF 2.0 file: " + file_name);
+
+    std::string json;
+    const uint8_t *binary = nullptr;
+    size_t binary_size = 0;
+
+    size_t end = std::min<size_t>(load<uint32_t>(data + 8), file.size());
+    for (size_t offset = 12; offset + 8 <= end;)
+    {
+        size_t length = load<uint32_t>(data + offset);
+        uint32_t type = load<uint32_t>(data + offset + 4);
+        offset += 8;
+        if (length > end - offset)
+            throw std::runtime_error("Truncated chunk in " + file_name);
+
+        if (type == json_chunk)
+            json.assign(reinterpret_cast<const char *>(data + offset), length);
+        else if (type == binary_chunk)
+        {
+            binary = data + offset;
+            binary_size = length;
+        }
+        offset += length;
+    }
+
+    // JSON is valid YAML, so the scene parser can read the glTF description
+    fkyaml::node root = fkyaml::node::deserialize(json);
+
+    std::vector<Vec4> positions;
+    std::vector<Vec4> normals;
+    std::vector<Vec3> textures;
+
+    count = 0;
+    elements.clear();
+
+    // Appends the triangle primitives of a mesh with the node transform applied to their vertices
+    auto load_mesh = [&](size_t index, const Matrix4 &matrix)
+    {
+        if (!root.contains("meshes") || index >= root["meshes"].size())
+            throw std::runtime_error("glTF mesh index is out of bounds in " + file_name);
+
+        // Normals are transformed by the cofactor matrix, the inverse transpose scaled by the determinant
+        Vec4 x{matrix.at(0, 0), matrix.at(1, 0), matrix.at(2, 0), 0};
+        Vec4 y{matrix.at(0, 1), matrix.at(1, 1), matrix.at(2, 1), 0};
+        Vec4 z{matrix.at(0, 2), matrix.at(1, 2), matrix.at(2, 2), 0};
+        Vec4 cofactor_x = cross(y, z), cofactor_y = cross(z, x), cofactor_z = cross(x, y);
+        float determinant = dot(x, cofactor_x);
+        float orientation = determinant < 0 ? -1.0f : 1.0f;
+
+        // A mirroring transform turns the triangles inside out, so their winding is reversed
+        const size_t corners[2][3] = {{0, 1, 2}, {0, 2, 1}};
+        const size_t *order = corners[determinant < 0];
+
+        for (const auto &primitive : root["meshes"][index]["primitives"])
+        {
+            // Only triangle lists are supported
+            if (get_size(primitive, "mode", 4) != 4)
+                continue;
+
+            const fkyaml::node &attributes = primitive["attributes"];
+            if (!attributes.contains("POSITION"))
+                continue;
+
+            GLTFAccessor position = get_accessor(root, get_size(attributes, "POSITION"), binary, binary_size);
+            GLTFAccessor normal, texture;
+            if (attributes.contains("NORMAL"))
+                normal = get_accessor(root, get_size(attributes, "NORMAL"), binary, binary_size);
+            if (attributes.contains("TEXCOORD_0"))
+                texture = get_accessor(root, get_size(attributes, "TEXCOORD_0"), binary, binary_size);
+
+            if (position.components < 3 || (normal && normal.components < 3) || (texture && texture.components < 2))
+                throw std::runtime_error("glTF attribute has too few components in " + file_name);
+
+            size_t base = positions.size();
+            size_t size = position.count;
+            size_t first_triangle = elements.size() / 3;
+            positions.resize(base + size);
+            normals.resize(base + size, Vec4(0, 0, 0, 0));
+            textures.resize(base + size);
+
+            for (size_t i = 0; i < size; ++i)
+            {
+                positions[base + i] = matrix * Vec4{get_float(position, i, 0), get_float(position, i, 1), get_float(position, i, 2), 1};
+                if (normal && i < normal.count)
+                {
+                    Vec4 direction = cofactor_x * get_float(normal, i, 0) + cofactor_y * get_float(normal, i, 1) + cofactor_z * get_float(normal, i, 2);
+                    normals[base + i] = normalize(direction * orientation);
+                }
+                // glTF places the texture origin at the top left instead of the bottom left
+                if (texture && i < texture.count)
+                    textures[base + i] = {get_float(texture, i, 0), 1.0f - get_float(texture, i, 1)};
+            }
+
+            if (primitive.contains("indices"))
+            {
+                GLTFAccessor indices = get_accessor(root, get_size(primitive, "indices"), binary, binary_size);
+                for (size_t i = 0; i + 2 < indices.count; i += 3)
+                {
+                    for (size_t j = 0; j < 3; ++j)
+                    {
+                        uint32_t index = get_index(indices, i + order[j]);
+                        if (index >= size)
+                            throw std::runtime_error("glTF index is out of bounds in " + file_name);
+                        elements.push_back(static_cast<uint32_t>(base + index));
+                    }
+                }
+            }
+            else
+            {
+                for (size_t i = 0; i + 2 < size; i += 3)
+                    for (size_t j = 0; j < 3; ++j)
+                        elements.push_back(static_cast<uint32_t>(base + i + order[j]));
+            }
+
+            // Only primitives without normals are smoothed, so the authored normals of the others are kept
+            count = elements.size() / 3;
+            if (!normal)
+                smooth_normals(positions, normals, base, first_triangle);
+        }
+    };
+
+    if (root.contains("scenes") && root.contains("nodes"))
+    {
+        const fkyaml::node &nodes = root["nodes"];
+        size_t scene_index = get_size(root, "scene");
+        if (scene_index >= root["scenes"].size())
+            throw std::runtime_error("glTF scene index is out of bounds in " + file_name);
+
+        std::vector<std::pair<size_t, Matrix4>> stack;
+        const fkyaml::node &scene = root["scenes"][scene_index];
+        if (scene.contains("nodes"))
+            for (const auto &node : scene["nodes"])
+                stack.emplace_back(node.get_value<size_t>(), Matrix4::Identity);
+
+        // Each node has at most one parent, so visiting more nodes than exist means the hierarchy has a cycle
+        size_t visited = 0;
+        while (!stack.empty())
+        {
+            auto [index, parent] = stack.back();
+            stack.pop_back();
+            if (index >= nodes.size() || ++visited > nodes.size())
+                throw std::runtime_error("Invalid glTF node hierarchy in " + file_name);
+
+            const fkyaml::node &node = nodes[index];
+            Matrix4 matrix = parent * get_node_matrix(node);
+            if (node.contains("mesh"))
+                load_mesh(get_size(node, "mesh"), matrix);
+            if (node.contains("children"))
+                for (const auto &child : node["children"])
+                    stack.emplace_back(child.get_value<size_t>(), matrix);
+        }
     }
+    else if (root.contains("meshes"))
+    {
+        // Without a scene every mesh is placed at the origin
+        for (size_t i = 0; i < root["meshes"].size(); ++i)
+            load_mesh(i, Matrix4::Identity);
+    }
+
+    bounds = {};
+    for (const Vec4 &position : positions)
+        bounds.expand(position);
+
+    pack(positions, normals, textures);
+    build_meshlets();
+}
+
+Mesh::Mesh(BinaryReader &reader)
+{
+    count = reader.read<uint64_t>();
+    reader.read(vertices);
+    position_offset = reader.read<Vec4>();
+    position_scale = reader.read<Vec4>();
+    reader.read(elements);
+    bounds = reader.read<BoundingBox>();
+    reader.read(meshlets);
+    reader.read(meshlet_vertices);
+    reader.read(lightmap_coordinates);
+    lightmap_resolution = reader.read<uint32_t>();
+    lightmap_cell_size = reader.read<uint32_t>();
+
+    if (elements.size() != count * 3)
+        throw std::runtime_error("Mesh size does not match its indices");
+    if (!lightmap_coordinates.empty() && lightmap_coordinates.size() != vertices.size() * 2)
+        throw std::runtime_error("Mesh lightmap coordinates do not match its vertices");
+}
+
+void Mesh::write(BinaryWriter &writer) const
+{
+    writer.write<uint64_t>(count);
+    writer.write(vertices);
+    writer.write(position_offset);
+    writer.write(position_scale);
+    writer.write(elements);
+    writer.write(bounds);
+    writer.write(meshlets);
+    writer.write(meshlet_vertices);
+    writer.write(lightmap_coordinates);
+    writer.write(lightmap_resolution);
+    writer.write(lightmap_cell_size);
 }
 
 const std::vector<Vec4> VertexBuffer::clipping_planes = {
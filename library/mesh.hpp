@@ -21,6 +21,7 @@
 #include <string>
 
 #include "vectors.hpp"
+#include "bounds.hpp"
 
 /**
  * A set of three indices.
@@ -38,22 +39,106 @@ struct Triplet
     friend std::ostream &operator<<(std::ostream &os, const Triplet &rhs);
 };
 
+/**
+ * A small cluster of neighbouring triangles that can be culled as a whole.
+ * https://developer.nvidia.com/blog/introduction-turing-mesh-shaders/
+ */
+struct Meshlet
+{
+    static constexpr size_t max_vertices = 64;
+    static constexpr size_t max_triangles = 124;
+
+    // The range of this meshlet's vertex indices in the mesh
+    uint32_t vertex_offset, vertex_count;
+    // The range of this meshlet's triangles in the mesh
+    uint32_t triangle_offset, triangle_count;
+
+    BoundingSphere bounds;
+
+    /**
+     * A cone containing all of the triangle normals. Any viewer inside of the
+     * cone past its apex can only see the back faces of the meshlet.
+     * A cutoff of 1 means that the meshlet cannot be backface culled.
+     */
+    Vec4 cone_apex, cone_axis;
+    float cone_cutoff;
+
+    // Only made of plain data, so bundles can store this as bytes
+    using plain_data = void;
+
+    /**
+     * Returns false if the meshlet is outside of the frustum or faces away from the camera.
+     * Both the frustum and the camera position must be in the mesh's local space.
+     */
+    bool is_visible(const Frustum &frustum, const Vec4 &camera) const;
+};
+
 /**
  * A collection of faces and vertices.
  */
 class Mesh
 {
 private:
+    /**
+     * A compact vertex, decoded when it is read by the vertex stage.
+     * Positions are 16-bit fractions of the mesh bounds, normals use an
+     * octahedral mapping onto two 16-bit values, and texture coordinates are half floats.
+     * https://jcgt.org/published/0003/02/01/
+     *
+     * Tangents are stored as an angle around the normal, with the handedness of the
+     * bitangent in the highest bit.
+     */
+    struct PackedVertex
+    {
+        uint16_t position[3];
+        int16_t normal[2];
+        uint16_t texture[2];
+        uint16_t tangent;
+    };
+
     size_t count;
-    std::vector<Vec4> vertices;
-    std::vector<Vec4> normals;
-    std::vector<Vec3> textures;
+    std::vector<PackedVertex> vertices;
+
+    // Maps the quantized positions back onto the mesh bounds
+    Vec4 position_offset, position_scale;
 
     /**
      * A vertex buffer containing 3 indices per face.
      */
     std::vector<uint32_t> elements;
 
+    BoundingBox bounds;
+
+    std::vector<Meshlet> meshlets;
+    std::vector<uint32_t> meshlet_vertices;
+
+    // Two 16-bit fractions per vertex locating it in a lightmap, only present in meshes from `with_lightmap_coordinates`
+    std::vector<uint16_t> lightmap_coordinates;
+    uint32_t lightmap_resolution = 0, lightmap_cell_size = 0;
+
+    /**
+     * Compresses the full precision vertex attributes into the packed vertex format.
+     * The triangles must already be loaded so that tangents can be computed.
+     */
+    void pack(const std::vector<Vec4> &positions, const std::vector<Vec4> &normals, const std::vector<Vec3> &textures);
+
+    /**
+     * Computes the direction of increasing texture u coordinate at each vertex, orthogonal to its normal.
+     * The w component holds the handedness of the bitangent, either 1 or -1.
+     * https://terathon.com/blog/tangent-space.html
+     */
+    std::vector<Vec4> compute_tangents(const std::vector<Vec4> &positions, const std::vector<Vec4> &normals, const std::vector<Vec3> &textures) const;
+
+    /**
+     * Replaces each normal from `first_vertex` onward with the average of its adjacent faces from `first_triangle` onward.
+     */
+    void smooth_normals(const std::vector<Vec4> &positions, std::vector<Vec4> &normals, size_t first_vertex = 0, size_t first_triangle = 0) const;
+
+    /**
+     * Greedily groups consecutive triangles into meshlets and computes their bounds.
+     */
+    void build_meshlets();
+
 public:
     Mesh() = delete;
 
@@ -63,10 +148,28 @@ public:
     Mesh(const std::string &file_name) { load_file(file_name); }
 
     /**
-     * Loads the faces of the mesh using a Wavefront .obj file.
+     * Reads a mesh stored with `write`, which skips parsing and preprocessing the original file.
+     */
+    Mesh(BinaryReader &reader);
+
+    /**
+     * Loads the faces of the mesh using a Wavefront .obj file, or a binary glTF file if the name ends in .glb.
      */
     void load_file(const std::string &file_name);
 
+    /**
+     * Loads the triangles of every mesh instance in the default scene of a binary glTF file into this mesh,
+     * baking the node transforms into the vertices. Files without scenes load each mesh untransformed.
+     * The attributes are read straight out of the mapped binary chunk.
+     * https://registry.khronos.org/glTF/specs/2.0/glTF-2.0.html#glb-file-format-specification
+     */
+    void load_glb(const std::string &file_name);
+
+    /**
+     * Stores the packed vertices, indices, and meshlets of the mesh.
+     */
+    void write(BinaryWriter &writer) const;
+
     // Returns the number of triangles
     size_t size() const { return count; }
     // Returns the number of vertices
@@ -80,11 +183,53 @@ public:
 
     Triplet operator[](size_t i) const { return at(i); }
 
-    const Vec4 &get_vertex(size_t i) const { return vertices[i]; }
-    const Vec3 &get_texture(size_t i) const { return textures[i]; }
-    const Vec4 &get_normal(size_t i) const { return normals[i]; }
+    Vec4 get_vertex(size_t i) const;
+    Vec3 get_texture(size_t i) const;
+    Vec4 get_normal(size_t i) const;
+
+    /**
+     * Returns the tangent of a vertex, with the handedness of its bitangent in the w component.
+     * The bitangent is `cross(normal, tangent) * w`.
+     */
+    Vec4 get_tangent(size_t i) const;
+
+    /**
+     * Returns a copy of the mesh with a second set of texture coordinates that gives every triangle its own
+     * part of a square lightmap. Pairs of triangles share the cells of a grid, so vertices are no longer shared.
+     * Triangle `i` takes the lower left half of cell `i / 2` when `i` is even and the upper right half when it is odd,
+     * with cells numbered in rows starting from the top left.
+     * @param texels The width of each cell in texels, lowered if needed to keep the lightmap at most `max_lightmap_resolution` wide.
+     */
+    Mesh with_lightmap_coordinates(uint32_t texels) const;
 
-    void smooth_normals();
+    static constexpr uint32_t max_lightmap_resolution = 2048;
+
+    bool has_lightmap_coordinates() const { return !lightmap_coordinates.empty(); }
+
+    // Returns the width and height of the lightmap that the lightmap coordinates were laid out for
+    uint32_t get_lightmap_resolution() const { return lightmap_resolution; }
+    // Returns the width of each cell in the lightmap in texels
+    uint32_t get_lightmap_cell_size() const { return lightmap_cell_size; }
+
+    Vec3 get_lightmap_coordinates(size_t i) const
+    {
+        return {lightmap_coordinates[i * 2] / 65535.0f, lightmap_coordinates[i * 2 + 1] / 65535.0f};
+    }
+
+    /**
+     * Returns the number of bytes used by this mesh, including its vertex and index storage.
+     */
+    size_t memory_size() const;
+
+    // Returns the box bounding all vertices in local space
+    const BoundingBox &get_bounds() const { return bounds; }
+
+    // Returns the number of meshlets
+    size_t meshlet_size() const { return meshlets.size(); }
+
+    const Meshlet &get_meshlet(size_t i) const { return meshlets[i]; }
+    // Returns the index of a vertex referenced by a meshlet
+    uint32_t get_meshlet_vertex(size_t i) const { return meshlet_vertices[i]; }
 };
 
 class VertexBuffer{
@@ -94,15 +239,27 @@ public:
     struct Vertex {
         Vec4 world_coordinates;
         Vec4 world_normals;
+        Vec4 world_tangents;
         Vec4 clip_coordinates;
         Vec3 texture_coordinates;
+        Vec3 lightmap_coordinates;
+        // The lit color of the vertex, only used when shading per vertex
+        Color color;
         Vec3 screen_coordinates;
     };
 
     size_t size() const { return data.size(); }
+
+    /**
+     * Discards any vertices added by clipping so the buffer can be reused.
+     */
+    void reset(size_t size) { data.resize(size); }
+
     Vertex &at(size_t i) { return data[i]; }
     Vertex &operator[](size_t i) { return at(i); }
 
+    void push_back(const Vertex &vertex) { data.push_back(vertex); }
+
     /**
      * Clips the given vertices against the screen boundaries using the Sutherland-Hodgman algorithm.
      * @param input_list A vector of the triangle's indices.
@@ -114,8 +271,11 @@ private:
         data.emplace_back(
             data[start].world_coordinates   * (a) + data[end].world_coordinates   * (1 - a),
             data[start].world_normals       * (a) + data[end].world_normals       * (1 - a),
+            data[start].world_tangents      * (a) + data[end].world_tangents      * (1 - a),
             data[start].clip_coordinates    * (a) + data[end].clip_coordinates    * (1 - a),
-            data[start].texture_coordinates * (a) + data[end].texture_coordinates * (1 - a)
+            data[start].texture_coordinates * (a) + data[end].texture_coordinates * (1 - a),
+            data[start].lightmap_coordinates * (a) + data[end].lightmap_coordinates * (1 - a),
+            data[start].color               * (a) + data[end].color               * (1 - a)
         );
         return data.size() - 1;
     }
@@ -146,4 +146,29 @@ Quaternion normalize(const Quaternion &input)
 Quaternion conjugate(const Quaternion &input)
 {
     return {input.w, -input.x, -input.y, -input.z};
-}
\ No newline at end of file
+}
+
+Quaternion slerp(const Quaternion &from, const Quaternion &to, float t)
+{
+    // q and -q are the same rotation, flip one so the interpolation goes the short way around
+    Quaternion target = to;
+    float cosine = dot(from, to);
+    if (cosine < 0.0f)
+    {
+        target *= -1.0f;
+        cosine = -cosine;
+    }
+
+    // Nearly parallel rotations would divide by almost zero, so fall back to a normalized lerp
+    float a = 1.0f - t, b = t;
+    if (cosine < 0.9995f)
+    {
+        float angle = std::acos(cosine);
+        float inverse_sine = 1.0f / std::sin(angle);
+        a = std::sin(a * angle) * inverse_sine;
+        b = std::sin(b * angle) * inverse_sine;
+    }
+
+    Quaternion result{a * from.w + b * target.w, a * from.x + b * target.x, a * from.y + b * target.y, a * from.z + b * target.z};
+    return normalize(result);
+}
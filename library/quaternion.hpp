@@ -46,6 +46,9 @@ public:
      */
     Quaternion(const Vec3 &axis, float angle);
 
+    // The copies below only copy the fields, so bundles can store this as bytes
+    using plain_data = void;
+
     /**
      * Copy constructor.
      * Constructs a copy of the given quaternion.
@@ -135,4 +138,12 @@ Quaternion normalize(const Quaternion &input);
  * @note For the special case of rotation quaternions, this is equal to its inverse.
  * @return The inverse of the rotation
  */
-Quaternion conjugate(const Quaternion &input);
\ No newline at end of file
+Quaternion conjugate(const Quaternion &input);
+
+/**
+ * Spherically interpolates between two rotations at a constant angular speed, taking the shorter path.
+ * @cite https://en.wikipedia.org/wiki/Slerp
+ * @param t The fraction of the way from `from` to `to`, between zero (0) and one (1)
+ * @return A unit quaternion between the two rotations
+ */
+Quaternion slerp(const Quaternion &from, const Quaternion &to, float t);
@@ -17,8 +17,57 @@
 
 #include "render.hpp"
 
+#include <map>
+
 constexpr double epsilon = -1E-5;
 
+// Objects set to automatic shading are shaded per vertex when their triangles average fewer pixels than this
+constexpr float vertex_shading_area = 4.0f;
+
+View::View(const Scene &scene)
+    : eye(scene.get_camera().position),
+      m_view(quick_matrix_inverse(translate(eye) * rotate(scene.get_camera().rotation))),
+      m_projection(perspective_projection(scene.get_fov(), scene.get_aspect_ratio(), 1, 100)),
+      m_view_projection(m_projection * m_view),
+      m_screen(screen_space(scene.get_width(), scene.get_height())),
+      m_cull(m_view_projection),
+      frustum(m_cull),
+      scissor{0, 0, scene.get_width(), scene.get_height()}
+{
+}
+
+// Scales and shifts clip space so that the scissor fills it, leaving everything outside of it to be culled.
+// The scissor is grown by a pixel on each side so rounding cannot cull anything that touches its edge.
+static Matrix4 crop_region(uint32_t width, uint32_t height, const Scissor &scissor)
+{
+    // Matches the integer half sizes used by screen_space for the full image
+    float half_width = width / 2;
+    float half_height = height / 2;
+
+    float x0 = scissor.x0 - 1.0f, y0 = scissor.y0 - 1.0f;
+    float x1 = scissor.x1 + 1.0f, y1 = scissor.y1 + 1.0f;
+
+    Matrix4 matrix = Matrix4::Identity;
+    matrix.at(0, 0) = 2.0f * half_width / (x1 - x0);
+    matrix.at(0, 3) = 2.0f * (half_width - x0) / (x1 - x0) - 1.0f;
+    matrix.at(1, 1) = 2.0f * half_height / (y1 - y0);
+    matrix.at(1, 3) = 2.0f * (half_height - y0) / (y1 - y0) - 1.0f;
+    return matrix;
+}
+
+View::View(const Scene &scene, const Scissor &scissor) : View(scene)
+{
+    this->scissor = scissor;
+    m_cull = crop_region(scene.get_width(), scene.get_height(), scissor) * m_view_projection;
+    frustum = Frustum(m_cull);
+}
+
+// Covers every pixel of the buffer, for drawing without a scissor
+static Scissor get_scissor(const DepthBuffer &depth)
+{
+    return {0, 0, depth.get_width(), depth.get_height()};
+}
+
 void draw_line(Image &image, Vec3 &start, Vec3 &end)
 {
     float u, v, du, dv, step;
@@ -44,13 +93,15 @@ void draw_line(Image &image, Vec3 &start, Vec3 &end)
     }
 }
 
-void parallel_bounding_box(const std::function<void (uint32_t, uint32_t)> &action, const Vec3 &s0, const Vec3 &s1, const Vec3 &s2)
+void parallel_bounding_box(const std::function<void (uint32_t, uint32_t)> &action, const Vec3 &s0, const Vec3 &s1, const Vec3 &s2, const Scissor &scissor)
 {
-    // Calculate the bounding box around this triangle
-    uint32_t minu = std::round(std::min({s0.x, s1.x, s2.x}));
-    uint32_t maxu = std::round(std::max({s0.x, s1.x, s2.x}));
-    uint32_t minv = std::round(std::min({s0.y, s1.y, s2.y}));
-    uint32_t maxv = std::round(std::max({s0.y, s1.y, s2.y}));
+    // Calculate the bounding box around this triangle, limited to the scissor
+    int64_t minu = std::max<int64_t>(std::lround(std::min({s0.x, s1.x, s2.x})), scissor.x0);
+    int64_t maxu = std::min<int64_t>(std::lround(std::max({s0.x, s1.x, s2.x})), scissor.x1);
+    int64_t minv = std::max<int64_t>(std::lround(std::min({s0.y, s1.y, s2.y})), scissor.y0);
+    int64_t maxv = std::min<int64_t>(std::lround(std::max({s0.y, s1.y, s2.y})), scissor.y1);
+    if (minu >= maxu || minv >= maxv)
+        return;
 
     // Calculate the width and height of the bounding box
     uint32_t w = maxu - minu, h = maxv - minv;
@@ -78,6 +129,11 @@ inline Vec3 get_barycentric(const Vec3 &p, const Vec3 &s0, const Vec3 &s1, const
 }
 
 void iterate_depth(DepthBuffer &depth, const Vec3 &s0, const Vec3 &s1, const Vec3 &s2)
+{
+    iterate_depth(depth, s0, s1, s2, get_scissor(depth));
+}
+
+void iterate_depth(DepthBuffer &depth, const Vec3 &s0, const Vec3 &s1, const Vec3 &s2, const Scissor &scissor)
 {
     float z0 = s0.z, z1 = s1.z, z2 = s2.z; // get the depth of each vertex on the screen
 
@@ -94,14 +150,20 @@ void iterate_depth(DepthBuffer &depth, const Vec3 &s0, const Vec3 &s1, const Vec
 
         // Check if this pixel is closer to the screen
         float z = bc.x * z0 + bc.y * z1 + bc.z * z2;
-        if (z > depth.at(u, v))
-            depth.at(u, v) = z;
+        float &stored = depth.at(u - scissor.x0, v - scissor.y0);
+        if (z > stored)
+            stored = z;
     };
 
-    parallel_bounding_box(action, s0, s1, s2);
+    parallel_bounding_box(action, s0, s1, s2, scissor);
 }
 
 void iterate_shader(Image &image, DepthBuffer &depth, const std::function<Color(float, float, float)> shader, const Vec3 &s0, const Vec3 &s1, const Vec3 &s2)
+{
+    iterate_shader(image, depth, shader, s0, s1, s2, get_scissor(depth));
+}
+
+void iterate_shader(Image &image, DepthBuffer &depth, const std::function<Color(float, float, float)> shader, const Vec3 &s0, const Vec3 &s1, const Vec3 &s2, const Scissor &scissor)
 {
     float z0 = s0.z, z1 = s1.z, z2 = s2.z; // get the depth of each vertex on the screen
 
@@ -118,14 +180,15 @@ void iterate_shader(Image &image, DepthBuffer &depth, const std::function<Color(
 
         // Check if this pixel is closer to the screen
         float z = bc.x * z0 + bc.y * z1 + bc.z * z2;
-        if (z < depth.at(u, v)) return;
-        depth.at(u, v) = z;
+        float &stored = depth.at(u - scissor.x0, v - scissor.y0);
+        if (z < stored) return;
+        stored = z;
 
         Color color = shader(bc.x, bc.y, bc.z);
-        image.set_pixel(u, v, color);
+        image.set_pixel(u - scissor.x0, v - scissor.y0, color);
     };
 
-    parallel_bounding_box(action, s0, s1, s2);
+    parallel_bounding_box(action, s0, s1, s2, scissor);
 }
 
 void draw_barycentric(Image &image, DepthBuffer &depth, Color &color, Triplet triangle, VertexBuffer &vertices)
@@ -140,11 +203,18 @@ void draw_barycentric(Image &image, DepthBuffer &depth, Color &color, Triplet tr
     iterate_shader(image, depth, shader, v0.screen_coordinates, v1.screen_coordinates, v2.screen_coordinates);
 }
 
-void draw_barycentric(Image &image, DepthBuffer &depth, const Camera &camera, const LightCollection &lights, const Material &material, Triplet triangle, VertexBuffer &vertices)
+/**
+ * Shades a triangle with a shader specialized for the given material features.
+ * @param lightmap The object's baked diffuse light, or null if it does not have one.
+ */
+template <uint32_t Features>
+static void draw_barycentric(Image &image, DepthBuffer &depth, const Scissor &scissor, const Camera &camera, const LightCollection &lights, const Material &material, const Image *lightmap, Triplet triangle, VertexBuffer &vertices)
 {
     const VertexBuffer::Vertex &v0 = vertices[triangle[0]], &v1 = vertices[triangle[1]], &v2 = vertices[triangle[2]];
     float w0 = v0.clip_coordinates.w, w1 = v1.clip_coordinates.w, w2 = v2.clip_coordinates.w;
 
+    const Image *normal_map = material.get_normal_map();
+
     auto shader = [&](float a, float b, float c)
     {
         // Correct for the perspective. https://www.cs.ucr.edu/~craigs/courses/2020-fall-cs-130/lectures/perspective-correct-interpolation.pdf
@@ -156,72 +226,389 @@ void draw_barycentric(Image &image, DepthBuffer &depth, const Camera &camera, co
         Vec4 normal = normalize(v0.world_normals       * aw + v1.world_normals       * bw + v2.world_normals       * cw);
         Vec3 texture =     w * (v0.texture_coordinates * aw + v1.texture_coordinates * bw + v2.texture_coordinates * cw);
 
+        if constexpr ((Features & Material::NormalMapped) != 0)
+        {
+            Vec4 tangent = v0.world_tangents * aw + v1.world_tangents * bw + v2.world_tangents * cw;
+
+            // Build the tangent space from the interpolated vertex frame
+            float handedness = tangent.w < 0.0f ? -1.0f : 1.0f;
+            tangent.w = 0;
+            tangent = normalize(tangent - normal * dot(normal, tangent));
+            Vec4 bitangent = cross(normal, tangent) * handedness;
+
+            // Transform the sampled normal from tangent space to world space
+            Vec4 sample = normal_map->get_pixel(texture.x, texture.y) * 2.0f - 1.0f;
+            normal = normalize(tangent * sample.x + bitangent * sample.y + normal * sample.z);
+        }
+
+        Color irradiance;
+        if (lightmap)
+        {
+            Vec3 lightmap_texture = w * (v0.lightmap_coordinates * aw + v1.lightmap_coordinates * bw + v2.lightmap_coordinates * cw);
+            irradiance = lightmap->get_pixel(lightmap_texture.x, lightmap_texture.y);
+        }
+
         // Set the color using the material and lights
-        return material.get_color(world, normal, texture, lights, camera.position);
+        return material.shade<Features>(world, normal, texture, lights, camera.position, irradiance);
     };
 
-    iterate_shader(image, depth, shader, v0.screen_coordinates, v1.screen_coordinates, v2.screen_coordinates);
+    iterate_shader(image, depth, shader, v0.screen_coordinates, v1.screen_coordinates, v2.screen_coordinates, scissor);
 }
 
-Matrix4 tangent_space(const Matrix4 &m_model, const VertexBuffer::Vertex &v0, const VertexBuffer::Vertex &v1, const VertexBuffer::Vertex &v2)
+/**
+ * Fills a triangle by blending the lit colors of its vertices (Gouraud shading).
+ * Only the texture is still sampled per pixel.
+ */
+template <uint32_t Features>
+static void draw_gouraud(Image &image, DepthBuffer &depth, const Scissor &scissor, const Material &material, Triplet triangle, VertexBuffer &vertices)
 {
-    Vec4 edge1 = v1.world_coordinates - v0.world_coordinates;
-    Vec4 edge2 = v2.world_coordinates - v0.world_coordinates;
+    const VertexBuffer::Vertex &v0 = vertices[triangle[0]], &v1 = vertices[triangle[1]], &v2 = vertices[triangle[2]];
+    float w0 = v0.clip_coordinates.w, w1 = v1.clip_coordinates.w, w2 = v2.clip_coordinates.w;
+
+    auto shader = [&](float a, float b, float c)
+    {
+        float aw = a * w0, bw = b * w1, cw = c * w2;
+        float w = 1.0f / (aw + bw + cw);
 
-    Vec3 uv1 = v1.texture_coordinates - v0.texture_coordinates;
-    Vec3 uv2 = v2.texture_coordinates - v0.texture_coordinates;
+        Color color = (v0.color * aw + v1.color * bw + v2.color * cw) * w;
 
-    float det = 1.0f / (uv1.x * uv2.y - uv2.x * uv1.y);
+        if constexpr ((Features & Material::Textured) != 0)
+        {
+            Vec3 texture = w * (v0.texture_coordinates * aw + v1.texture_coordinates * bw + v2.texture_coordinates * cw);
+            color *= material.get_texture_map()->get_pixel(texture.x, texture.y);
+        }
 
-    Vec4 tangent{
-        (uv2.y * edge1.x - uv1.y * edge2.x) * det,
-        (uv2.y * edge1.y - uv1.y * edge2.y) * det,
-        (uv2.y * edge1.z - uv1.y * edge2.z) * det,
+        color.r = saturate(color.r);
+        color.g = saturate(color.g);
+        color.b = saturate(color.b);
+        return color;
     };
 
-    Vec4 normal    = normalize(cross(edge1, edge2));
-    tangent        = normalize(m_model * tangent);
-    tangent        = normalize(tangent - dot(tangent, normal) * normal);
-    Vec4 bitangent = normalize(m_model * cross(normal, tangent));
-
-    Matrix4 matrix;
-    matrix.at(0, 0) = tangent.x;
-    matrix.at(1, 0) = tangent.y;
-    matrix.at(2, 0) = tangent.z;
-    matrix.at(0, 1) = bitangent.x;
-    matrix.at(1, 1) = bitangent.y;
-    matrix.at(2, 1) = bitangent.z;
-    matrix.at(0, 2) = normal.x;
-    matrix.at(1, 2) = normal.y;
-    matrix.at(2, 2) = normal.z;
-    matrix.at(3, 3) = 1;
-    return matrix;
+    iterate_shader(image, depth, shader, v0.screen_coordinates, v1.screen_coordinates, v2.screen_coordinates, scissor);
 }
 
-void draw_barycentric(Image &image, DepthBuffer &depth, const Camera &camera, const Matrix4 &m_model, const LightCollection &lights, const Material &material, Triplet triangle, VertexBuffer &vertices)
+/**
+ * Returns whether an instance should be shaded per vertex instead of per pixel.
+ */
+static bool is_vertex_shaded(const View &view, const Object &instance, size_t triangle_count)
 {
-    const VertexBuffer::Vertex &v0 = vertices[triangle[0]], &v1 = vertices[triangle[1]], &v2 = vertices[triangle[2]];
-    float w0 = v0.clip_coordinates.w, w1 = v1.clip_coordinates.w, w2 = v2.clip_coordinates.w;
+    if (instance.shading != Shading::Automatic)
+        return instance.shading == Shading::Vertex;
+
+    // Bound the object with a sphere and estimate how many pixels it covers from its distance to the eye
+    BoundingBox bounds = instance.get_bounds();
+    Vec4 extent = bounds.high - bounds.low;
+    extent.w = 0;
+    float radius = 0.5f * magnitude(extent);
+    Vec4 offset = bounds.center() - view.eye;
+    offset.w = 0;
+    float distance = magnitude(offset);
+    if (distance <= radius)
+        return false;
+
+    float pixels_per_unit = view.m_projection.at(1, 1) * view.m_screen.at(1, 1);
+    float screen_radius = radius / distance * pixels_per_unit;
+
+    // About half of a closed mesh faces away from the camera
+    float area = Pi * screen_radius * screen_radius;
+    return area < vertex_shading_area * 0.5f * triangle_count;
+}
 
-    const Image &normal_map = material.get_normal_map();
-    Matrix4 m_TBN = tangent_space(m_model, v0, v1, v2);
+void draw_barycentric(Image &image, DepthBuffer &depth, const Camera &camera, const LightCollection &lights, const Material &material, Triplet triangle, VertexBuffer &vertices)
+{
+    dispatch_features(material.get_features(), [&]<uint32_t Features>()
+                      { draw_barycentric<Features>(image, depth, get_scissor(depth), camera, lights, material, nullptr, triangle, vertices); });
+}
 
-    auto shader = [&](float a, float b, float c)
+// Transforms, clips, and culls one instance's triangles, reusing the buffers in `prepared` and the scratch lists
+static void prepare_instance(const View &view, const Mesh &mesh, const Material &material, const Object &instance, PreparedInstance &prepared,
+                             std::vector<bool> &transformed, std::vector<Triplet> &triangles, std::vector<uint32_t> &indices)
+{
+    // Tangents are only needed to apply a normal map
+    bool normal_mapped = (material.get_features() & Material::NormalMapped) != 0;
+
+    const Transform &transform = instance.transform;
+    const LightCollection &lights = *instance.lights;
+    bool vertex_shaded = is_vertex_shaded(view, instance, mesh.size());
+    const Image *lightmap = instance.lightmap.get();
+
+    prepared.material = &material;
+    prepared.lightmap = lightmap;
+    prepared.lights = instance.lights;
+    prepared.vertex_shaded = vertex_shaded;
+    VertexBuffer &vertices = prepared.vertices;
+
+    // Define the model matrix
+    Matrix4 m_model = transform.get_matrix();
+
+    // Bring the view frustum and camera into the mesh's local space for culling
+    Frustum frustum(view.m_cull * m_model);
+    Vec4 local_camera = transform.get_inverse_matrix() * view.eye;
+
+    transformed.resize(mesh.vertex_size());
+    vertices.reset(mesh.vertex_size());
+    std::fill(transformed.begin(), transformed.end(), false);
+    triangles.clear();
+
+    // Loop through all meshlets, skipping those that cannot be seen before doing any per-vertex work
+    for (size_t m = 0; m < mesh.meshlet_size(); ++m)
     {
-        // Correct for the perspective. https://www.cs.ucr.edu/~craigs/courses/2020-fall-cs-130/lectures/perspective-correct-interpolation.pdf
-        float aw = a * w0, bw = b * w1, cw = c * w2;
-        float w = 1.0f / (aw + bw + cw);
+        const Meshlet &meshlet = mesh.get_meshlet(m);
+        if (!meshlet.is_visible(frustum, local_camera))
+            continue;
+
+        // Transform the meshlet's vertices to world space and then to clip space
+        for (size_t k = 0; k < meshlet.vertex_count; ++k)
+        {
+            uint32_t i = mesh.get_meshlet_vertex(meshlet.vertex_offset + k);
+            if (transformed[i])
+                continue;
+            transformed[i] = true;
+
+            vertices[i].world_coordinates   = m_model * mesh.get_vertex(i);
+            vertices[i].world_normals       = m_model * mesh.get_normal(i);
+            vertices[i].clip_coordinates    = view.m_view_projection * vertices[i].world_coordinates;
+            vertices[i].texture_coordinates = mesh.get_texture(i);
+
+            if (lightmap)
+                vertices[i].lightmap_coordinates = mesh.get_lightmap_coordinates(i);
+
+            if (normal_mapped)
+            {
+                Vec4 tangent = mesh.get_tangent(i);
+                float handedness = tangent.w;
+                tangent.w = 0;
+                vertices[i].world_tangents = m_model * tangent;
+                vertices[i].world_tangents.w = handedness;
+            }
+
+            // Light the vertex now so clipping can interpolate the color, leaving the texture for the rasterizer
+            if (vertex_shaded)
+            {
+                Color irradiance;
+                if (lightmap)
+                    irradiance = lightmap->get_pixel(vertices[i].lightmap_coordinates.x, vertices[i].lightmap_coordinates.y);
+
+                uint32_t features = material.get_features() & ~(Material::Textured | Material::NormalMapped);
+                dispatch_features(features, [&]<uint32_t Features>()
+                                  { vertices[i].color = material.shade<Features>(vertices[i].world_coordinates, normalize(vertices[i].world_normals), vertices[i].texture_coordinates, lights, view.eye, irradiance); });
+            }
+        }
+
+        // Loop through all triangles in the meshlet
+        for (size_t k = 0; k < meshlet.triangle_count; ++k)
+        {
+            Triplet triangle = mesh[meshlet.triangle_offset + k];
+            indices.assign(triangle.indices, triangle.indices + 3);
+
+            // Clip triangles such that they are bounded within [-w, w] on all axes
+            vertices.sutherland_hodgman_clip(indices);
+
+            // Reform triangles using fan triangulation
+            for (size_t j = 2; j < indices.size(); ++j)
+                triangles.emplace_back(indices[0], indices[j - 1], indices[j]);
+        }
+    }
 
-        // Interpolate across all of the vertex values
-        Vec4 world =       w * (v0.world_coordinates   * aw + v1.world_coordinates   * bw + v2.world_coordinates   * cw);
-        Vec3 texture =     w * (v0.texture_coordinates * aw + v1.texture_coordinates * bw + v2.texture_coordinates * cw);
-    
-        Vec4 normal = normalize(v0.world_normals * aw + v1.world_normals * bw + v2.world_normals * cw);
-        if (normal_map) normal = normalize(m_TBN * (normal_map.get_pixel(texture.x, texture.y) * 2.0f - 1.0f));
+    // Transform from clip space to screen space
+    for (size_t i = 0; i < vertices.size(); ++i)
+    {
+        // Vertices added by clipping are always transformed
+        if (i < transformed.size() && !transformed[i])
+            continue;
 
-        // Set the color using the material and lights
-        return material.get_color(world, normal, texture, lights, camera.position);
+        Vec4 &clip = vertices[i].clip_coordinates;
+
+        // Scale by the depth
+        float temp = clip.w;
+        if (temp != 0) {
+            temp = 1.0f / temp;
+            clip *= temp;
+        }
+
+        vertices[i].screen_coordinates = view.m_screen * clip;
+
+        clip.w = temp; // store the w value for later
+    }
+
+    prepared.triangles.clear();
+
+    for (size_t i = 0; i < triangles.size(); ++i)
+    {
+        Triplet triangle = triangles[i];
+
+        // Backface culling
+        Vec4 ab = vertices[triangle[1]].clip_coordinates - vertices[triangle[0]].clip_coordinates;
+        Vec4 ac = vertices[triangle[2]].clip_coordinates - vertices[triangle[0]].clip_coordinates;
+
+        // Ignore triangles that are ordered incorrectly
+        float orientation = ab.x * ac.y - ac.x * ab.y;
+        if (orientation > 0.0f)
+            prepared.triangles.emplace_back(triangle);
+    }
+}
+
+// Fills the depth of an instance's triangles and then shades them
+static void rasterize_instance(Image &image, DepthBuffer &depth, const Scissor &scissor, const Camera &camera, PreparedInstance &prepared)
+{
+    VertexBuffer &vertices = prepared.vertices;
+    const Material &material = *prepared.material;
+    const LightCollection &lights = *prepared.lights;
+    const Image *lightmap = prepared.lightmap;
+    bool vertex_shaded = prepared.vertex_shaded;
+
+    // Calculate the depth of each triangle
+    for (auto &triangle : prepared.triangles)
+        iterate_depth(depth, vertices[triangle[0]].screen_coordinates, vertices[triangle[1]].screen_coordinates, vertices[triangle[2]].screen_coordinates, scissor);
+
+    // Draw each triangle with the shader variant for the material, chosen once for the whole draw
+    dispatch_features(material.get_features(), [&]<uint32_t Features>()
+                      {
+                          if (vertex_shaded)
+                          {
+                              for (auto &triangle : prepared.triangles)
+                                  draw_gouraud<Features>(image, depth, scissor, material, triangle, vertices);
+                          }
+                          else
+                          {
+                              for (auto &triangle : prepared.triangles)
+                                  draw_barycentric<Features>(image, depth, scissor, camera, lights, material, lightmap, triangle, vertices);
+                          }
+                      });
+}
+
+void draw_instances(Image &image, DepthBuffer &depth, const View &view, const Mesh &mesh, const Material &material, const std::vector<const Object *> &instances)
+{
+    Camera camera{view.eye};
+
+    // One set of buffers is reused for every instance
+    PreparedInstance prepared;
+    std::vector<bool> transformed;
+    std::vector<Triplet> triangles;
+    std::vector<uint32_t> indices;
+
+    for (const Object *instance : instances)
+    {
+        prepare_instance(view, mesh, material, *instance, prepared, transformed, triangles, indices);
+        rasterize_instance(image, depth, view.scissor, camera, prepared);
+    }
+}
+
+// Objects that share a mesh and material, drawn together as instances
+struct Batch
+{
+    const Mesh &mesh;
+    const Material &material;
+    std::vector<const Object *> instances;
+};
+
+// Groups the objects that share a mesh and material, in the order each group first appears
+static std::vector<Batch> get_batches(const std::vector<std::shared_ptr<Object>> &objects)
+{
+    std::vector<Batch> batches;
+    std::map<std::pair<const Mesh *, const Material *>, size_t> batch_indices;
+
+    for (const auto &object : objects)
+    {
+        auto key = std::make_pair(object->mesh.get(), object->material.get());
+        auto [it, inserted] = batch_indices.try_emplace(key, batches.size());
+        if (inserted)
+            batches.push_back({*object->mesh, *object->material, {}});
+        batches[it->second].instances.push_back(object.get());
+    }
+    return batches;
+}
+
+void draw_objects(Image &image, DepthBuffer &depth, const View &view, const std::vector<std::shared_ptr<Object>> &objects)
+{
+    for (const Batch &batch : get_batches(objects))
+        draw_instances(image, depth, view, batch.mesh, batch.material, batch.instances);
+}
+
+// Copies the parts of a prepared instance that are drawn, keeping only the vertices its triangles use
+static void compact_instance(PreparedInstance &source, PreparedInstance &compact, std::vector<uint32_t> &remap)
+{
+    compact.material = source.material;
+    compact.lightmap = source.lightmap;
+    compact.lights = source.lights;
+    compact.vertex_shaded = source.vertex_shaded;
+
+    remap.assign(source.vertices.size(), UINT32_MAX);
+    compact.triangles.reserve(source.triangles.size());
+
+    auto get_index = [&](uint32_t i)
+    {
+        if (remap[i] == UINT32_MAX)
+        {
+            remap[i] = static_cast<uint32_t>(compact.vertices.size());
+            compact.vertices.push_back(source.vertices[i]);
+        }
+        return remap[i];
     };
 
-    iterate_shader(image, depth, shader, v0.screen_coordinates, v1.screen_coordinates, v2.screen_coordinates);
+    for (const Triplet &triangle : source.triangles)
+    {
+        uint32_t a = get_index(triangle[0]), b = get_index(triangle[1]), c = get_index(triangle[2]);
+        compact.triangles.emplace_back(a, b, c);
+    }
+}
+
+PreparedFrame prepare_objects(const View &view, const std::vector<std::shared_ptr<Object>> &objects)
+{
+    PreparedFrame frame{Camera{view.eye}, view.scissor, {}};
+
+    // The vertex stage works in one buffer the size of the mesh, and the frame keeps a compact copy of what is drawn
+    PreparedInstance prepared;
+    std::vector<bool> transformed;
+    std::vector<Triplet> triangles;
+    std::vector<uint32_t> indices;
+
+    for (const Batch &batch : get_batches(objects))
+    {
+        for (const Object *instance : batch.instances)
+        {
+            prepare_instance(view, batch.mesh, batch.material, *instance, prepared, transformed, triangles, indices);
+
+            // Instances with nothing on screen are not kept
+            if (!prepared.triangles.empty())
+                compact_instance(prepared, frame.instances.emplace_back(), indices);
+        }
+    }
+    return frame;
+}
+
+void draw_prepared(Image &image, DepthBuffer &depth, PreparedFrame &frame)
+{
+    for (PreparedInstance &instance : frame.instances)
+        rasterize_instance(image, depth, frame.scissor, frame.camera, instance);
+}
+
+void draw_strips(const Scene &scene, uint32_t strip_rows, bool bottom_up, const std::function<void(const Image &, uint32_t)> &output)
+{
+    uint32_t width = scene.get_width(), height = scene.get_height();
+    strip_rows = std::max(strip_rows, 1u);
+    uint32_t strips = (height + strip_rows - 1) / strip_rows;
+
+    DepthBuffer depth(width, std::min(strip_rows, height));
+
+    for (uint32_t i = 0; i < strips; ++i)
+    {
+        uint32_t strip = bottom_up ? strips - 1 - i : i;
+        uint32_t first_row = strip * strip_rows;
+        uint32_t rows = std::min(strip_rows, height - first_row);
+
+        // Only the last strip can be shorter and needs its own depth buffer
+        if (depth.get_height() != rows)
+            depth = DepthBuffer(width, rows);
+        depth.clear();
+
+        Image image(width, rows, scene.get_framebuffer_format());
+        image.set_bottom_up(true);
+
+        // Each strip is a scissor of the full view, so objects outside of it are skipped entirely
+        View view(scene, Scissor{0, first_row, width, first_row + rows});
+        draw_objects(image, depth, view, scene.get_visible_objects(view.frustum, view.eye));
+
+        output(image, first_row);
+    }
 }
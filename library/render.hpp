@@ -23,18 +23,54 @@
 #include "scene.hpp"
 #include "library.hpp"
 
+/**
+ * The pixels of the full image that are drawn, from (x0, y0) up to but not including (x1, y1).
+ * Triangles keep their full image coordinates and only the pixels inside are filled, into an image
+ * of just that size shifted by (x0, y0), so they match the same pixels of the full image exactly.
+ */
+struct Scissor
+{
+    uint32_t x0, y0, x1, y1;
+};
+
+/**
+ * The camera transforms shared by everything drawn in a frame.
+ */
+struct View
+{
+    View(const Scene &scene);
+
+    /**
+     * Views only the pixels of the scene's image inside the scissor. The projection is the same as the full
+     * image's, but objects and meshlets outside of the scissor are culled.
+     */
+    View(const Scene &scene, const Scissor &scissor);
+
+    Vec4 eye;
+    Matrix4 m_view, m_projection, m_view_projection, m_screen;
+    // The view projection narrowed to the scissor, only used for culling
+    Matrix4 m_cull;
+    Frustum frustum;
+    Scissor scissor;
+};
+
 /**
  * Uses the Digital Differential Analyzer (DDA) method to draw a line from 'start' to 'end'.
  */
 void draw_line(Image &image, const Vec3 &start, const Vec3 &end);
 
-void parallel_bounding_box(const std::function<void (uint32_t, uint32_t)> &action, const Vec3 &s0, const Vec3 &s1, const Vec3 &s2);
+/**
+ * Calls the action for every pixel of the triangle's bounding box that is inside the scissor.
+ */
+void parallel_bounding_box(const std::function<void (uint32_t, uint32_t)> &action, const Vec3 &s0, const Vec3 &s1, const Vec3 &s2, const Scissor &scissor);
 
 inline Vec3 get_barycentric(const Vec3 &p, const Vec3 &s0, const Vec3 &s1, const Vec3 &s2);
 
 void iterate_depth(DepthBuffer &depth, const Vec3 &s0, const Vec3 &s1, const Vec3 &s2);
+void iterate_depth(DepthBuffer &depth, const Vec3 &s0, const Vec3 &s1, const Vec3 &s2, const Scissor &scissor);
 
 void iterate_shader(Image &image, DepthBuffer &depth, const std::function<Color(float, float, float)> shader, const Vec3 &s0, const Vec3 &s1, const Vec3 &s2);
+void iterate_shader(Image &image, DepthBuffer &depth, const std::function<Color(float, float, float)> shader, const Vec3 &s0, const Vec3 &s1, const Vec3 &s2, const Scissor &scissor);
 
 /**
  * Uses barycentric coordinates to fill a triangle with the given color.
@@ -43,11 +79,66 @@ void draw_barycentric(Image &image, DepthBuffer &depth, Color &color, Triplet tr
 
 /**
  * Uses the object's material and all light sources provided to determine the color of each pixel.
+ * Applies the material's normal map using the interpolated tangent frame of the vertices, if it has one.
  */
 void draw_barycentric(Image &image, DepthBuffer &depth, const Camera &camera, const LightCollection &lights, const Material &mat, Triplet triangle, VertexBuffer &vertices);
 
 /**
- * Uses the object's material and all light sources provided to determine the color of each pixel.
- * Computes the TBN matrix and uses a normal map.
+ * Draws objects that all use the given mesh and material, each with its own transform and lights.
+ * All instances share a single vertex buffer and the per-frame setup.
+ */
+void draw_instances(Image &image, DepthBuffer &depth, const View &view, const Mesh &mesh, const Material &material, const std::vector<const Object *> &instances);
+
+/**
+ * Draws a list of objects, submitting the objects that share a mesh and material together as instances.
+ * Batches are drawn in the order their first object appears in the list.
+ */
+void draw_objects(Image &image, DepthBuffer &depth, const View &view, const std::vector<std::shared_ptr<Object>> &objects);
+
+/**
+ * An instance's triangles after the vertex stage, ready to be rasterized.
+ * The object's lights are shared so the scene can move on to the next frame while the instance is drawn,
+ * but the material and lightmap are only referred to and must outlive it.
+ */
+struct PreparedInstance
+{
+    const Material *material = nullptr;
+    const Image *lightmap = nullptr;
+    std::shared_ptr<const LightCollection> lights;
+    bool vertex_shaded = false;
+
+    VertexBuffer vertices{0};
+    // The clipped triangles that face the camera
+    std::vector<Triplet> triangles;
+};
+
+/**
+ * The results of the vertex stage for every object in a frame.
+ */
+struct PreparedFrame
+{
+    Camera camera;
+    Scissor scissor;
+    std::vector<PreparedInstance> instances;
+};
+
+/**
+ * Runs the vertex stage for a list of objects in the same order `draw_objects` would draw them.
+ * Rasterizing the result with `draw_prepared` gives the same image as `draw_objects`, but the two
+ * stages can run on different threads, such as preparing the next frame of an animation while drawing this one.
+ */
+PreparedFrame prepare_objects(const View &view, const std::vector<std::shared_ptr<Object>> &objects);
+
+/**
+ * Rasterizes and shades the instances of a prepared frame.
+ */
+void draw_prepared(Image &image, DepthBuffer &depth, PreparedFrame &frame);
+
+/**
+ * Draws the scene in horizontal strips of rows, so only one strip's color and depth buffers are in memory at a time.
+ * @param strip_rows The height of each strip, the last strip may be shorter.
+ * @param bottom_up Visits the strips from the last row to the first, which is the order of the rows in image files
+ * since the strips are drawn bottom up.
+ * @param output Called with each finished strip and the row of the full image it starts at.
  */
-void draw_barycentric(Image &image, DepthBuffer &depth, const Camera &camera, const Matrix4 &m_model, const LightCollection &lights, const Material &material, Triplet triangle, VertexBuffer &vertices);
\ No newline at end of file
+void draw_strips(const Scene &scene, uint32_t strip_rows, bool bottom_up, const std::function<void(const Image &, uint32_t)> &output);
@@ -16,23 +16,389 @@
  */
 
 #include "scene.hpp"
+#include "lightmap.hpp"
 
 #include "../thirdparty/fkYAML/node.hpp"
 
+#include <algorithm>
+#include <cstring>
 #include <fstream>
-#include <iostream>
+#include <stdexcept>
 
 template <typename T>
-const T &get_reference(const std::string &key, std::map<std::string, std::unique_ptr<T>> &unique_map)
+SceneManager::Handle<T> SceneManager::load(const std::string &name, std::map<std::string, Entry<T>> &cache, const std::function<std::shared_ptr<const T>()> &factory)
 {
-    if (!unique_map.contains(key))
-        unique_map[key] = std::make_unique<T>(key);
-    return *unique_map[key];
+    std::lock_guard<std::mutex> lock(mutex);
+
+    // Duplicate requests share the first request's handle, so each asset is only loaded once
+    auto it = cache.find(name);
+    if (it != cache.end())
+    {
+        it->second.last_used = ++clock;
+        return it->second.handle;
+    }
+
+    // Make room for the new asset before loading it
+    trim_locked();
+
+    Handle<T> handle = pool.submit(factory).share();
+    cache.emplace(name, Entry<T>{handle, ++clock});
+    return handle;
 }
 
-const Mesh &SceneManager::get_mesh(const std::string &name) { return get_reference(name, meshes); }
+SceneManager::Handle<Mesh> SceneManager::load_mesh(const std::string &name)
+{
+    return load<Mesh>(name, meshes, [name]()
+                      { return std::make_shared<const Mesh>(name); });
+}
+
+SceneManager::Handle<Material> SceneManager::load_material(const std::string &name)
+{
+    auto factory = [this, name]()
+    {
+        auto load_texture = [this](const std::string &path)
+        { return get_texture(path); };
+        return std::make_shared<const Material>(name, load_texture);
+    };
+    return load<Material>(name, materials, factory);
+}
 
-const Material &SceneManager::get_material(const std::string &name) { return get_reference(name, materials); }
+// Returns whether a file holds exactly the given bytes
+static bool has_contents(const std::string &path, const MappedFile &file)
+{
+    try
+    {
+        MappedFile other(path);
+        return other.size() == file.size() && std::memcmp(other.data(), file.data(), file.size()) == 0;
+    }
+    catch (const std::exception &)
+    {
+        return false;
+    }
+}
+
+std::shared_ptr<const Image> SceneManager::get_texture(const std::string &path)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto known = texture_keys.find(path);
+        if (known != texture_keys.end())
+        {
+            auto it = textures.find(known->second);
+            if (it != textures.end())
+            {
+                it->second.last_used = ++clock;
+                Handle<Image> handle = it->second.handle;
+                return handle.get();
+            }
+        }
+    }
+
+    MappedFile file(path);
+    uint64_t hash = hash_bytes(file.data(), file.size());
+
+    // Other files with the same hash are only shared if their bytes match too
+    std::vector<std::string> sources;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto it = textures.lower_bound({hash, ""}); it != textures.end() && it->first.first == hash; ++it)
+            sources.push_back(it->first.second);
+    }
+
+    TextureKey key{hash, path};
+    for (const std::string &source : sources)
+    {
+        if (source == path || has_contents(source, file))
+        {
+            key.second = source;
+            break;
+        }
+    }
+
+    std::promise<std::shared_ptr<const Image>> promise;
+    Handle<Image> handle;
+    bool owner = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        // The matching texture may have been evicted while the files were compared
+        if (!textures.contains(key))
+            key.second = path;
+        texture_keys[path] = key;
+
+        auto it = textures.find(key);
+        if (it != textures.end())
+        {
+            it->second.last_used = ++clock;
+            handle = it->second.handle;
+        }
+        else
+        {
+            trim_locked();
+            handle = promise.get_future().share();
+            textures.emplace(key, Entry<Image>{handle, ++clock});
+            owner = true;
+        }
+    }
+
+    // Decode the image on this thread instead of the pool. Material loads run on the pool
+    // themselves, and waiting there for another queued task could deadlock.
+    if (owner)
+    {
+        try
+        {
+            auto image = std::make_shared<Image>();
+            image->load_memory(file.data(), file.size());
+            promise.set_value(std::move(image));
+        }
+        catch (...)
+        {
+            promise.set_exception(std::current_exception());
+        }
+    }
+
+    return handle.get();
+}
+
+SceneManager::Lightmap SceneManager::get_lightmap(const std::shared_ptr<const Mesh> &mesh, const Matrix4 &m_model, const LightCollection &lights, uint32_t texels)
+{
+    // Objects that share a mesh also share its copy with lightmap coordinates
+    BinaryWriter mesh_key;
+    mesh_key.write(reinterpret_cast<uintptr_t>(mesh.get()));
+    mesh_key.write(texels);
+
+    Lightmap lightmap;
+    if (mesh->has_lightmap_coordinates())
+        lightmap.mesh = mesh;
+    else
+        lightmap.mesh = bake<Mesh>(mesh_key.get_bytes(), mesh, lightmap_meshes, [&]()
+                                   { return std::make_shared<const Mesh>(mesh->with_lightmap_coordinates(texels)); });
+
+    BinaryWriter key;
+    key.write_bytes(mesh_key.get_bytes().data(), mesh_key.get_bytes().size());
+    key.write(m_model);
+    for (const auto &light : lights)
+        light->write(key);
+
+    lightmap.image = bake<Image>(key.get_bytes(), mesh, lightmaps, [&]()
+                                 { return std::make_shared<const Image>(bake_lightmap(*lightmap.mesh, m_model, lights)); });
+    return lightmap;
+}
+
+template <typename T>
+std::shared_ptr<const T> SceneManager::bake(const std::string &key, const std::shared_ptr<const Mesh> &source, std::map<std::string, BakedEntry<T>> &cache, const std::function<std::shared_ptr<const T>()> &factory)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = cache.find(key);
+        if (it != cache.end())
+        {
+            it->second.last_used = ++clock;
+            Handle<T> handle = it->second.handle;
+            return handle.get();
+        }
+    }
+
+    // Baking can take a while, so it happens without holding the lock
+    std::promise<std::shared_ptr<const T>> promise;
+    promise.set_value(factory());
+
+    std::lock_guard<std::mutex> lock(mutex);
+    trim_locked();
+
+    // Another thread may have baked the same asset in the meantime, in which case its copy is kept
+    auto [it, inserted] = cache.try_emplace(key, BakedEntry<T>{{promise.get_future().share(), ++clock}, source});
+    return it->second.handle.get();
+}
+
+template <typename T>
+static bool is_ready(const SceneManager::Handle<T> &handle)
+{
+    return handle.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+template <typename T>
+static bool has_failed(const SceneManager::Handle<T> &handle)
+{
+    try
+    {
+        handle.get();
+        return false;
+    }
+    catch (...)
+    {
+        return true;
+    }
+}
+
+template <typename T>
+static size_t get_memory_size(const SceneManager::Handle<T> &handle)
+{
+    // Failed loads hold an exception instead of an asset
+    try
+    {
+        const auto &asset = handle.get();
+        return asset ? asset->memory_size() : 0;
+    }
+    catch (...)
+    {
+        return 0;
+    }
+}
+
+size_t SceneManager::memory_size()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    size_t total = 0;
+    for (const auto &[name, entry] : meshes)
+        if (is_ready(entry.handle))
+            total += get_memory_size(entry.handle);
+    for (const auto &[name, entry] : materials)
+        if (is_ready(entry.handle))
+            total += get_memory_size(entry.handle);
+    for (const auto &[key, entry] : textures)
+        if (is_ready(entry.handle))
+            total += get_memory_size(entry.handle);
+    for (const auto &[key, entry] : lightmap_meshes)
+        total += get_memory_size(entry.handle);
+    for (const auto &[key, entry] : lightmaps)
+        total += get_memory_size(entry.handle);
+    return total;
+}
+
+void SceneManager::set_memory_budget(size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    memory_budget = bytes;
+    trim_locked();
+}
+
+void SceneManager::trim()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    trim_locked();
+}
+
+void SceneManager::trim_locked()
+{
+    struct Candidate
+    {
+        uint64_t last_used;
+        size_t size;
+        std::function<void()> evict;
+    };
+
+    // Failed loads are forgotten right away, so a later request tries the file again
+    auto drop_failed = [](auto &cache)
+    {
+        std::erase_if(cache, [](const auto &item)
+                      { return is_ready(item.second.handle) && has_failed(item.second.handle); });
+    };
+    drop_failed(meshes);
+    drop_failed(materials);
+    drop_failed(textures);
+
+    // Evicting a material can release its textures, so keep going until nothing else can be evicted
+    bool evicted = true;
+    while (evicted)
+    {
+        evicted = false;
+
+        size_t total = 0;
+        std::vector<Candidate> candidates;
+
+        auto collect = [&](auto &cache)
+        {
+            for (auto it = cache.begin(); it != cache.end(); ++it)
+            {
+                // Assets that are still loading are always kept
+                const auto &entry = it->second;
+                if (!is_ready(entry.handle))
+                    continue;
+
+                size_t size = get_memory_size(entry.handle);
+                total += size;
+
+                // The cache's own handle holds one reference, anything more means the asset is in use
+                bool failed = size == 0;
+                if (failed || entry.handle.get().use_count() <= 1)
+                    candidates.push_back({entry.last_used, size, [&cache, it]()
+                                          { cache.erase(it); }});
+            }
+        };
+
+        collect(meshes);
+        collect(materials);
+        collect(textures);
+        collect(lightmap_meshes);
+        collect(lightmaps);
+
+        if (total <= memory_budget)
+            break;
+
+        std::sort(candidates.begin(), candidates.end(), [](const Candidate &a, const Candidate &b)
+                  { return a.last_used < b.last_used; });
+
+        for (const Candidate &candidate : candidates)
+        {
+            if (total <= memory_budget)
+                break;
+            candidate.evict();
+            total -= candidate.size;
+            evicted = true;
+        }
+    }
+
+    // Forget the paths whose texture was evicted
+    std::erase_if(texture_keys, [this](const auto &item)
+                  { return !textures.contains(item.second); });
+}
+
+Matrix4 Transform::get_matrix() const { return translate(position) * rotate(rotation) * ::scale(scale); }
+
+Matrix4 Transform::get_inverse_matrix() const
+{
+    Vec3 inverse_scale{1.0f / scale.x, 1.0f / scale.y, 1.0f / scale.z};
+    return ::scale(inverse_scale) * rotate(conjugate(rotation)) * translate(-position);
+}
+
+Animation::Animation(const std::vector<Keyframe> &keyframes) : keyframes(keyframes)
+{
+    std::stable_sort(this->keyframes.begin(), this->keyframes.end(), [](const Keyframe &a, const Keyframe &b)
+                     { return a.time < b.time; });
+}
+
+void Animation::add_keyframe(float time, const Transform &transform)
+{
+    auto it = std::upper_bound(keyframes.begin(), keyframes.end(), time, [](float time, const Keyframe &keyframe)
+                               { return time < keyframe.time; });
+    keyframes.insert(it, {time, transform});
+}
+
+Transform Animation::sample(float time) const
+{
+    if (keyframes.empty())
+        return Transform();
+
+    // Find the first keyframe after the time, the one before it is where the interpolation starts
+    auto next = std::upper_bound(keyframes.begin(), keyframes.end(), time, [](float time, const Keyframe &keyframe)
+                                 { return time < keyframe.time; });
+    if (next == keyframes.begin())
+        return next->transform;
+    if (next == keyframes.end())
+        return keyframes.back().transform;
+
+    const Keyframe &start = *(next - 1), &end = *next;
+    float t = (time - start.time) / (end.time - start.time);
+
+    Transform transform;
+    transform.position = start.transform.position * (1.0f - t) + end.transform.position * t;
+    transform.rotation = slerp(start.transform.rotation, end.transform.rotation, t);
+    transform.scale = start.transform.scale * (1.0f - t) + end.transform.scale * t;
+    return transform;
+}
+
+BoundingBox Object::get_bounds() const { return ::transform(get_model_matrix(), mesh->get_bounds()); }
 
 void from_node(const fkyaml::node &node, Color &color)
 {
@@ -87,25 +453,124 @@ void from_node(const fkyaml::node &node, Quaternion &rotation)
     }
 }
 
+void from_node(const fkyaml::node &node, Transform &transform)
+{
+    // Anything left out keeps the identity transform
+    if (node.contains("position"))
+        transform.position = node["position"].get_value<Vec4>();
+    if (node.contains("rotation"))
+        transform.rotation = node["rotation"].get_value<Quaternion>();
+    if (node.contains("scale"))
+        transform.scale = node["scale"].get_value<Vec4>();
+}
+
+// Reads the keyframes listed under a node, where anything a keyframe leaves out is taken from the base transform
+static Animation read_animation(const fkyaml::node &node, const Transform &base)
+{
+    Animation animation;
+    if (!node.contains("keyframes") || !node["keyframes"].is_sequence())
+        return animation;
+
+    for (const auto &keyframe_node : node["keyframes"])
+    {
+        Transform transform = base;
+        from_node(keyframe_node, transform);
+        animation.add_keyframe(keyframe_node["time"].get_value<float>(), transform);
+    }
+    return animation;
+}
+
 Scene::Scene(const std::string &config, SceneManager &manager)
     : width(400), height(300), fov(70)
 {
-    try
+    // Bundles already contain every asset, so nothing is loaded through the manager
+    if (is_bundle(config))
     {
-        std::ifstream fs(config);
+        read_bundle(config);
+        animate(0.0f);
+        build_hierarchy();
+        assign_lights();
+        return;
+    }
 
-        fkyaml::node root = fkyaml::node::deserialize(fs);
+    std::ifstream fs(config);
+    read_config(fs, manager);
+}
+
+Scene::Scene(std::istream &config, SceneManager &manager)
+    : width(400), height(300), fov(70)
+{
+    read_config(config, manager);
+}
+
+void Scene::read_config(std::istream &config, SceneManager &manager)
+{
+    uint32_t lightmap_texels = default_lightmap_texels;
+
+    // The number of frames to render, zero to fit the keyframes
+    uint32_t frames = 0;
+
+    try
+    {
+        fkyaml::node root = fkyaml::node::deserialize(config);
 
         width = root["resolution"]["width"].get_value<uint32_t>();
         height = root["resolution"]["height"].get_value<uint32_t>();
         fov = root["fov"].get_value<float>();
 
+        if (root["resolution"].contains("format"))
+        {
+            const std::string &name = root["resolution"]["format"].as_str();
+            if (name == "rgb32f")
+                framebuffer_format = Image::Format::RGB32F;
+            else if (name == "rgba8")
+                framebuffer_format = Image::Format::RGBA8;
+            else if (name == "rgb10a2")
+                framebuffer_format = Image::Format::RGB10A2;
+            else if (name == "rgba16f")
+                framebuffer_format = Image::Format::RGBA16F;
+            else
+                throw fkyaml::exception("Invalid framebuffer format");
+        }
+
         if (root.contains("camera"))
         {
             camera.position = root["camera"]["position"].get_value<Vec4>();
             camera.rotation = root["camera"]["rotation"].get_value<Quaternion>();
+            camera.animation = read_animation(root["camera"], {camera.position, camera.rotation});
+        }
+
+        if (root.contains("frame_rate"))
+            frame_rate = root["frame_rate"].get_value<float>();
+        if (frame_rate <= 0.0f)
+            throw fkyaml::exception("Frame rate must be positive");
+        if (root.contains("frames"))
+            frames = root["frames"].get_value<uint32_t>();
+
+        // Start loading every asset the scene uses before reading the rest of the file
+        if (root.contains("objects") && root["objects"].is_sequence())
+        {
+            for (const auto &object_node : root["objects"])
+            {
+                manager.load_mesh(object_node["mesh"].as_str());
+                manager.load_material(object_node["material"].as_str());
+            }
         }
 
+        // Point lights are cut off once they become dimmer than this
+        float light_threshold = PointLight::default_threshold;
+        if (root.contains("light_threshold"))
+            light_threshold = root["light_threshold"].get_value<float>();
+
+        if (root.contains("light_samples"))
+            light_samples = root["light_samples"].get_value<uint32_t>();
+
+        if (root.contains("approximate_distant_lights"))
+            approximate_distant_lights = root["approximate_distant_lights"].get_value<bool>();
+
+        if (root.contains("lightmap_texels"))
+            lightmap_texels = root["lightmap_texels"].get_value<uint32_t>();
+
         if (root.contains("lights") && root["lights"].is_sequence())
         {
             for (const auto &light_node : root["lights"])
@@ -114,7 +579,7 @@ Scene::Scene(const std::string &config, SceneManager &manager)
 
                 Color color = light_node["color"].get_value<Color>();
 
-                std::shared_ptr<const Light> light;
+                std::shared_ptr<Light> light;
 
                 if (type == "directional")
                 {
@@ -126,7 +591,7 @@ Scene::Scene(const std::string &config, SceneManager &manager)
                 {
                     float intensity = light_node["intensity"].get_value<float>();
                     Vec4 position = light_node["position"].get_value<Vec4>();
-                    light = std::make_shared<PointLight>(color, intensity, position);
+                    light = std::make_shared<PointLight>(color, intensity, position, light_threshold);
                 }
                 else if (type == "spot")
                 {
@@ -137,6 +602,13 @@ Scene::Scene(const std::string &config, SceneManager &manager)
                     Vec4 position = light_node["position"].get_value<Vec4>();
                     light = std::make_shared<SpotLight>(color, angle, taper, direction, position);
                 }
+                else
+                {
+                    throw fkyaml::exception(("Unknown light type " + type).c_str());
+                }
+
+                if (light_node.contains("baked"))
+                    light->set_baked(light_node["baked"].get_value<bool>());
 
                 lights.push_back(light);
             }
@@ -145,20 +617,319 @@ Scene::Scene(const std::string &config, SceneManager &manager)
         if (root.contains("objects") && root["objects"].is_sequence()) {
             for (const auto &object_node : root["objects"])
             {
-                auto object = std::make_shared<Object>(
-                    object_node["position"].get_value<Vec4>(),
-                    object_node["rotation"].get_value<Quaternion>(),
-                    object_node["scale"].get_value<Vec4>(),
-                    manager.get_mesh(object_node["mesh"].as_str()),
-                    manager.get_material(object_node["material"].as_str())
-                );
-
-                objects.push_back(object);
+                auto mesh = manager.get_mesh(object_node["mesh"].as_str());
+                auto material = manager.get_material(object_node["material"].as_str());
+
+                Shading shading = Shading::Pixel;
+                if (object_node.contains("shading"))
+                {
+                    const std::string &name = object_node["shading"].as_str();
+                    if (name == "vertex")
+                        shading = Shading::Vertex;
+                    else if (name == "auto")
+                        shading = Shading::Automatic;
+                    else if (name != "pixel")
+                        throw fkyaml::exception("Invalid shading frequency");
+                }
+
+                bool baked = object_node.contains("baked") && object_node["baked"].get_value<bool>();
+
+                auto add_object = [&](const fkyaml::node &node)
+                {
+                    auto object = std::make_shared<Object>(node.get_value<Transform>(), mesh, material, nullptr, shading, baked);
+                    object->animation = read_animation(node, object->transform);
+                    if (baked && !object->animation.empty())
+                        throw fkyaml::exception("Baked objects cannot be animated");
+                    objects.push_back(object);
+                };
+
+                // A list of instances places many copies of the same mesh and material
+                if (object_node.contains("instances") && object_node["instances"].is_sequence())
+                {
+                    for (const auto &instance_node : object_node["instances"])
+                        add_object(instance_node);
+                }
+                else
+                {
+                    add_object(object_node);
+                }
             }
         }
     }
-    catch (const fkyaml::exception &e) 
+    catch (const fkyaml::exception &e)
+    {
+        // Rendering the defaults would hide a broken config, so the caller has to handle it
+        throw std::runtime_error(std::string("Invalid scene config: ") + e.what());
+    }
+
+    // Enough frames to reach the last keyframe, unless the config says otherwise
+    float duration = camera.animation.get_duration();
+    for (const auto &object : objects)
+        duration = std::max(duration, object->animation.get_duration());
+    frame_count = static_cast<uint32_t>(duration * frame_rate) + 1;
+    if (frames > 0)
+        frame_count = frames;
+
+    animate(0.0f);
+    build_hierarchy();
+    bake_lightmaps(manager, lightmap_texels);
+    assign_lights();
+}
+
+bool Scene::is_bundle(const std::string &file_name)
+{
+    std::ifstream file(file_name, std::ios::binary);
+    uint32_t magic = 0;
+    file.read(reinterpret_cast<char *>(&magic), sizeof(magic));
+    return file && magic == bundle_magic;
+}
+
+// Stored in place of a texture index for objects without a lightmap
+static constexpr uint32_t no_lightmap = std::numeric_limits<uint32_t>::max();
+
+// Returns the index of an item in the list, adding it to the end if it is not there yet
+template <typename T>
+static uint32_t get_index(std::vector<T> &list, const T &item)
+{
+    auto it = std::find(list.begin(), list.end(), item);
+    if (it != list.end())
+        return static_cast<uint32_t>(it - list.begin());
+    list.push_back(item);
+    return static_cast<uint32_t>(list.size() - 1);
+}
+
+void Scene::write_bundle(const std::string &file_name) const
+{
+    // Shared assets are stored once and referred to by their index
+    std::vector<std::shared_ptr<const Mesh>> meshes;
+    std::vector<std::shared_ptr<const Material>> materials;
+    std::vector<std::shared_ptr<const Image>> textures;
+
+    std::vector<std::pair<uint32_t, uint32_t>> object_assets;
+    for (const auto &object : objects)
+        object_assets.emplace_back(get_index(meshes, object->mesh), get_index(materials, object->material));
+
+    for (const auto &material : materials)
+        for (const auto &texture : material->get_textures())
+            get_index(textures, texture);
+    for (const auto &object : objects)
+        if (object->lightmap)
+            get_index(textures, object->lightmap);
+
+    BinaryWriter writer(file_name);
+    writer.write(bundle_magic);
+    writer.write(bundle_version);
+
+    writer.write(width);
+    writer.write(height);
+    writer.write(fov);
+    writer.write(framebuffer_format);
+    writer.write(camera.position);
+    writer.write(camera.rotation);
+    writer.write(camera.animation.get_keyframes());
+    writer.write(frame_rate);
+    writer.write(frame_count);
+
+    writer.write(lights.get_ambient_strength());
+    writer.write<uint64_t>(std::distance(lights.begin(), lights.end()));
+    for (const auto &light : lights)
+        light->write(writer);
+    writer.write(light_samples);
+    writer.write(approximate_distant_lights);
+
+    writer.write<uint64_t>(textures.size());
+    for (const auto &texture : textures)
+        texture->write(writer);
+
+    writer.write<uint64_t>(meshes.size());
+    for (const auto &mesh : meshes)
+        mesh->write(writer);
+
+    writer.write<uint64_t>(materials.size());
+    for (const auto &material : materials)
+        material->write(writer, textures);
+
+    writer.write<uint64_t>(objects.size());
+    for (size_t i = 0; i < objects.size(); ++i)
+    {
+        writer.write(objects[i]->transform);
+        writer.write(object_assets[i].first);
+        writer.write(object_assets[i].second);
+        writer.write(objects[i]->shading);
+        writer.write(objects[i]->baked);
+        writer.write(objects[i]->lightmap ? get_index(textures, objects[i]->lightmap) : no_lightmap);
+        writer.write(objects[i]->animation.get_keyframes());
+    }
+}
+
+void Scene::read_bundle(const std::string &file_name)
+{
+    BinaryReader reader(file_name);
+    if (reader.read<uint32_t>() != bundle_magic)
+        throw std::runtime_error("Not a scene bundle: " + file_name);
+    if (reader.read<uint32_t>() != bundle_version)
+        throw std::runtime_error("Unsupported scene bundle version: " + file_name);
+
+    width = reader.read<uint32_t>();
+    height = reader.read<uint32_t>();
+    fov = reader.read<float>();
+    framebuffer_format = reader.read<Image::Format>();
+    camera.position = reader.read<Vec4>();
+    camera.rotation = reader.read<Quaternion>();
+    std::vector<Animation::Keyframe> keyframes;
+    reader.read(keyframes);
+    camera.animation = Animation(keyframes);
+    frame_rate = reader.read<float>();
+    frame_count = reader.read<uint32_t>();
+
+    lights = LightCollection(reader.read<Color>());
+    for (uint64_t i = reader.read<uint64_t>(); i > 0; --i)
+        lights.push_back(Light::read(reader));
+    light_samples = reader.read<uint32_t>();
+    approximate_distant_lights = reader.read<bool>();
+
+    std::vector<std::shared_ptr<const Image>> textures(reader.read<uint64_t>());
+    for (auto &texture : textures)
+        texture = std::make_shared<const Image>(reader);
+
+    std::vector<std::shared_ptr<const Mesh>> meshes(reader.read<uint64_t>());
+    for (auto &mesh : meshes)
+        mesh = std::make_shared<const Mesh>(reader);
+
+    std::vector<std::shared_ptr<const Material>> materials(reader.read<uint64_t>());
+    for (auto &material : materials)
+        material = std::make_shared<const Material>(reader, textures);
+
+    objects.resize(reader.read<uint64_t>());
+    for (auto &object : objects)
+    {
+        Transform transform = reader.read<Transform>();
+        uint32_t mesh = reader.read<uint32_t>();
+        uint32_t material = reader.read<uint32_t>();
+        Shading shading = reader.read<Shading>();
+        bool baked = reader.read<bool>();
+        uint32_t lightmap = reader.read<uint32_t>();
+        if (mesh >= meshes.size() || material >= materials.size() || (lightmap != no_lightmap && lightmap >= textures.size()))
+            throw std::runtime_error("Object refers to a missing asset in " + file_name);
+        object = std::make_shared<Object>(transform, meshes[mesh], materials[material], nullptr, shading, baked);
+        if (lightmap != no_lightmap)
+            object->lightmap = textures[lightmap];
+        reader.read(keyframes);
+        object->animation = Animation(keyframes);
+    }
+}
+
+static std::vector<BoundingBox> get_object_bounds(const std::vector<std::shared_ptr<Object>> &objects)
+{
+    std::vector<BoundingBox> boxes;
+    boxes.reserve(objects.size());
+    for (const auto &object : objects)
+        boxes.push_back(object->get_bounds());
+    return boxes;
+}
+
+void Scene::build_hierarchy() { hierarchy.build(get_object_bounds(objects)); }
+
+void Scene::refit_hierarchy() { hierarchy.refit(get_object_bounds(objects)); }
+
+void Scene::assign_lights()
+{
+    std::vector<BoundingBox> bounds = get_object_bounds(objects);
+
+    std::vector<LightCollection> collections(objects.size(), LightCollection(lights.get_ambient_strength()));
+
+    // Visiting the lights in order keeps each object's lights in the same order as the scene's
+    for (const auto &light : lights)
+    {
+        hierarchy.query(light->get_bounds(), [&](uint32_t i)
+                        {
+                            // Baked lights are already in the lightmap
+                            if (light->is_baked() && objects[i]->lightmap)
+                                return;
+                            if (light->affects(bounds[i]))
+                                collections[i].push_back(light); });
+    }
+
+    if (approximate_distant_lights)
+    {
+        for (size_t i = 0; i < objects.size(); ++i)
+            collections[i].build_irradiance(bounds[i]);
+    }
+
+    if (light_samples > 0)
+    {
+        for (size_t i = 0; i < objects.size(); ++i)
+            if (collections[i].size() > light_samples)
+                collections[i].build_sampler(light_samples, bounds[i]);
+    }
+
+    for (size_t i = 0; i < objects.size(); ++i)
+        objects[i]->lights = std::make_shared<const LightCollection>(std::move(collections[i]));
+}
+
+void Scene::bake_lightmaps(SceneManager &manager, uint32_t texels)
+{
+    std::vector<BoundingBox> bounds = get_object_bounds(objects);
+
+    for (size_t i = 0; i < objects.size(); ++i)
+    {
+        Object &object = *objects[i];
+        if (!object.baked || object.lightmap)
+            continue;
+
+        LightCollection baked_lights;
+        for (const auto &light : lights)
+            if (light->is_baked() && light->affects(bounds[i]))
+                baked_lights.push_back(light);
+        if (baked_lights.size() == 0)
+            continue;
+
+        SceneManager::Lightmap lightmap = manager.get_lightmap(object.mesh, object.get_model_matrix(), baked_lights, texels);
+        object.lightmap = lightmap.image;
+        object.mesh = lightmap.mesh;
+    }
+}
+
+bool Scene::is_animated() const
+{
+    return !camera.animation.empty() || std::any_of(objects.begin(), objects.end(), [](const auto &object)
+                                                    { return !object->animation.empty(); });
+}
+
+bool Scene::animate(float time)
+{
+    if (!camera.animation.empty())
     {
-        std::cerr << "Error: " << e.what() << std::endl;
+        Transform transform = camera.animation.sample(time);
+        camera.position = transform.position;
+        camera.rotation = transform.rotation;
     }
+
+    bool moved = false;
+    for (const auto &object : objects)
+    {
+        if (object->animation.empty())
+            continue;
+        object->transform = object->animation.sample(time);
+        moved = true;
+    }
+    return moved;
+}
+
+void Scene::set_time(float time)
+{
+    if (!animate(time))
+        return;
+
+    // Frames can be visited in any order, so the tree is rebuilt rather than refit from wherever it was last
+    build_hierarchy();
+    assign_lights();
+}
+
+std::vector<std::shared_ptr<Object>> Scene::get_visible_objects(const Frustum &frustum, const Vec4 &eye) const
+{
+    std::vector<std::shared_ptr<Object>> visible;
+    hierarchy.traverse(frustum, eye, [&](uint32_t i)
+                       { visible.push_back(objects[i]); });
+    return visible;
 }
@@ -18,35 +18,229 @@
 #pragma once
 
 #include <map>
+#include <istream>
 
 #include "vectors.hpp"
 #include "quaternion.hpp"
 #include "mesh.hpp"
 #include "light.hpp"
+#include "bvh.hpp"
 
 /**
  * Manages the meshes and textures used by objects across scenes.
  * 
- * Stores only a single copy of each mesh and material to reduce memory cost of duplicate objects.
+ * Stores only a single copy of each mesh, material, and texture to reduce memory cost of duplicate objects.
+ * Assets are loaded in the background on a thread pool, and it is safe to request them from multiple threads.
+ *
+ * Assets stay cached after they are no longer used so that later scenes can share them. When the cache
+ * grows past its memory budget, the least recently used assets that nothing else refers to are dropped.
  */
 class SceneManager {
 public:
-    const Mesh &get_mesh(const std::string &name);
-    const Material &get_material(const std::string &name);
+    template <typename T>
+    using Handle = std::shared_future<std::shared_ptr<const T>>;
+
+    static constexpr size_t unlimited = std::numeric_limits<size_t>::max();
+
+    /**
+     * @param memory_budget The number of bytes the cache tries to stay below.
+     */
+    explicit SceneManager(size_t memory_budget = unlimited) : memory_budget(memory_budget) {}
+
+    /**
+     * Starts loading a mesh in the background if it has not been requested before.
+     * @return A handle that becomes ready once the mesh is loaded.
+     */
+    Handle<Mesh> load_mesh(const std::string &name);
+    Handle<Material> load_material(const std::string &name);
+
+    /**
+     * Waits for an asset to finish loading.
+     * The asset will not be evicted while the returned pointer, or any copy of it, is alive.
+     */
+    std::shared_ptr<const Mesh> get_mesh(const std::string &name) { return load_mesh(name).get(); }
+    std::shared_ptr<const Material> get_material(const std::string &name) { return load_material(name).get(); }
+
+    /**
+     * Loads a texture on the calling thread, or waits for it if another thread is already loading it.
+     * Files with the same contents are only decoded and stored once, so copies of an image saved under
+     * different paths share a texture. Files are found by their hash and then compared byte for byte.
+     */
+    std::shared_ptr<const Image> get_texture(const std::string &path);
+
+    struct Lightmap
+    {
+        // A copy of the mesh with lightmap coordinates
+        std::shared_ptr<const Mesh> mesh;
+        std::shared_ptr<const Image> image;
+    };
+
+    /**
+     * Bakes the diffuse light from a set of lights onto a mesh placed by the model matrix, see `bake_lightmap`.
+     * Results are cached, so scenes that place the same mesh under the same baked lights skip baking.
+     * @param texels The width in texels of the lightmap area given to each pair of triangles.
+     */
+    Lightmap get_lightmap(const std::shared_ptr<const Mesh> &mesh, const Matrix4 &m_model, const LightCollection &lights, uint32_t texels);
+
+    /**
+     * Changes the memory budget and evicts assets until the cache fits, if possible.
+     */
+    void set_memory_budget(size_t bytes);
+    size_t get_memory_budget() const { return memory_budget; }
+
+    /**
+     * Returns the number of bytes used by all loaded assets in the cache.
+     */
+    size_t memory_size();
+
+    /**
+     * Evicts the least recently used assets that are not in use until the cache fits in the budget.
+     */
+    void trim();
 
 private:
-    std::map<std::string, std::unique_ptr<const Mesh>> meshes;
-    std::map<std::string, std::unique_ptr<const Material>> materials;
+    template <typename T>
+    struct Entry
+    {
+        Handle<T> handle;
+        uint64_t last_used;
+    };
+
+    template <typename T>
+    Handle<T> load(const std::string &name, std::map<std::string, Entry<T>> &cache, const std::function<std::shared_ptr<const T>()> &factory);
+
+    // Baked assets keep the mesh they were made from alive, so its address cannot be reused by another mesh while they are cached
+    template <typename T>
+    struct BakedEntry : Entry<T>
+    {
+        std::shared_ptr<const Mesh> source;
+    };
+
+    template <typename T>
+    std::shared_ptr<const T> bake(const std::string &key, const std::shared_ptr<const Mesh> &source, std::map<std::string, BakedEntry<T>> &cache, const std::function<std::shared_ptr<const T>()> &factory);
+
+    // Must be called while holding the mutex
+    void trim_locked();
+
+    std::mutex mutex;
+    std::map<std::string, Entry<Mesh>> meshes;
+    std::map<std::string, Entry<Material>> materials;
+    // Textures are keyed by the hash of their contents and the path of the file they were decoded from,
+    // so two different files with the same hash are kept apart
+    using TextureKey = std::pair<uint64_t, std::string>;
+    std::map<TextureKey, Entry<Image>> textures;
+
+    // Remembers which texture each path matched so the file is only read once
+    std::map<std::string, TextureKey> texture_keys;
+
+    // Keyed by the bytes of the source mesh's address, the texel density, and for lightmaps the placement and lights
+    std::map<std::string, BakedEntry<Mesh>> lightmap_meshes;
+    std::map<std::string, BakedEntry<Image>> lightmaps;
+
+    size_t memory_budget;
+    uint64_t clock = 0;
+
+    ThreadPool pool;
 };
 
-class Object
+/**
+ * The position, rotation, and scale of something placed in the scene.
+ */
+struct Transform
 {
-public:
     Vec4 position;
     Quaternion rotation;
-    Vec3 scale;
-    const Mesh &mesh;
-    const Material &material;
+    Vec3 scale{1};
+
+    // Only made of plain data, so bundles can store this as bytes
+    using plain_data = void;
+
+    // Converts from local space to world space
+    Matrix4 get_matrix() const;
+    // Converts from world space to local space
+    Matrix4 get_inverse_matrix() const;
+};
+
+/**
+ * A transform that changes over time, given by keyframes that are interpolated between.
+ * Positions and scales are interpolated linearly and rotations with `slerp`.
+ */
+class Animation
+{
+public:
+    struct Keyframe
+    {
+        // Seconds from the start of the animation
+        float time;
+        Transform transform;
+
+        // Only made of plain data, so bundles can store this as bytes
+        using plain_data = void;
+    };
+
+    Animation() = default;
+    Animation(const std::vector<Keyframe> &keyframes);
+
+    /**
+     * Adds a keyframe, keeping the keyframes sorted by time.
+     */
+    void add_keyframe(float time, const Transform &transform);
+
+    const std::vector<Keyframe> &get_keyframes() const { return keyframes; }
+    bool empty() const { return keyframes.empty(); }
+
+    // Returns the time of the last keyframe
+    float get_duration() const { return keyframes.empty() ? 0.0f : keyframes.back().time; }
+
+    /**
+     * Returns the transform at the given time. Before the first keyframe and after
+     * the last one, the transform of the closest keyframe is held.
+     */
+    Transform sample(float time) const;
+
+private:
+    std::vector<Keyframe> keyframes;
+};
+
+/**
+ * How often an object's material is evaluated.
+ */
+enum class Shading : uint32_t
+{
+    // Evaluate the material for every pixel
+    Pixel,
+    // Evaluate the material at each vertex and blend the colors across each triangle (Gouraud shading)
+    Vertex,
+    // Shade per vertex when the object's triangles are only a few pixels large on screen
+    Automatic,
+};
+
+class Object
+{
+public:
+    Transform transform;
+    std::shared_ptr<const Mesh> mesh;
+    std::shared_ptr<const Material> material;
+
+    // The lights that can reach this object, filled in by its scene. The collection is replaced rather than
+    // changed when the lights are reassigned, so a frame that is still being drawn can keep using it.
+    std::shared_ptr<const LightCollection> lights;
+
+    Shading shading = Shading::Pixel;
+
+    // Baked objects never move, so the diffuse light from baked lights is precomputed into their lightmap
+    bool baked = false;
+    std::shared_ptr<const Image> lightmap;
+
+    // Moves the object over time when the scene is animated, baked objects are never animated
+    Animation animation;
+
+    Matrix4 get_model_matrix() const { return transform.get_matrix(); }
+
+    /**
+     * Returns the box bounding the object's mesh in world space.
+     */
+    BoundingBox get_bounds() const;
 };
 
 class Camera
@@ -54,12 +248,35 @@ class Camera
 public:
     Vec4 position;
     Quaternion rotation;
+
+    // The scale of the keyframes is ignored
+    Animation animation;
 };
 
 class Scene {
 public:
+    /**
+     * Reads the scene from either a YAML config or a bundle written by `write_bundle`.
+     */
     Scene(const std::string &config, SceneManager &manager);
 
+    /**
+     * Reads the scene from a YAML config that is already in memory or arriving on a stream.
+     * Asset paths are relative to the working directory, the same as for config files.
+     */
+    Scene(std::istream &config, SceneManager &manager);
+
+    /**
+     * Saves the scene along with every mesh, material, and texture it uses into a single binary file.
+     * Loading a bundle skips parsing the config and decoding the assets, which speeds up repeated renders.
+     */
+    void write_bundle(const std::string &file_name) const;
+
+    /**
+     * Returns whether a file starts with the header of a scene bundle.
+     */
+    static bool is_bundle(const std::string &file_name);
+
     const std::vector<std::shared_ptr<Object>> &get_objects() const { return objects; }
     const LightCollection &get_lights() const { return lights; }
 
@@ -69,13 +286,93 @@ public:
 
     float get_fov() const { return fov; }
 
+    // Returns the pixel format that the scene should be rendered into
+    Image::Format get_framebuffer_format() const { return framebuffer_format; }
+
     const Camera &get_camera() const { return camera; }
 
+    // Returns whether the camera or any object has keyframes
+    bool is_animated() const;
+
+    float get_frame_rate() const { return frame_rate; }
+
+    /**
+     * Returns the number of frames in the animation. Unless the config sets it, this is
+     * enough frames to reach the last keyframe, or one frame if nothing is animated.
+     */
+    uint32_t get_frame_count() const { return frame_count; }
+
+    /**
+     * Moves the camera and every animated object to where they are at the given time in seconds,
+     * then updates the object hierarchy and the lights assigned to each object.
+     */
+    void set_time(float time);
+
+    /**
+     * Returns the objects that may be inside of the frustum, ordered from front to back.
+     */
+    std::vector<std::shared_ptr<Object>> get_visible_objects(const Frustum &frustum, const Vec4 &eye) const;
+
+    /**
+     * Updates the object hierarchy after any object has been moved, rotated, or scaled.
+     */
+    void refit_hierarchy();
+
+    /**
+     * Rebuilds the object hierarchy from scratch. This produces a tighter tree than
+     * refitting and should be used after objects have moved significantly.
+     */
+    void build_hierarchy();
+
+    /**
+     * Gives every object the list of lights that can reach its bounds, so shading skips the rest.
+     * Distant lights are moved into each object's spherical harmonics approximation if enabled, and then objects
+     * reached by more lights than the scene's `light_samples` shade a random subset of the rest instead.
+     * Must be called after the hierarchy is updated whenever objects or lights move.
+     */
+    void assign_lights();
+
+    /**
+     * The default width in texels of the lightmap area given to each pair of triangles.
+     */
+    static constexpr uint32_t default_lightmap_texels = 8;
+
+    /**
+     * Bakes the diffuse light from every baked light into a lightmap for each baked object that does not have one yet.
+     * The objects' meshes are replaced with copies that have lightmap coordinates, shared between objects with the same mesh.
+     * Must be called before `assign_lights`, which leaves baked lights out of objects with lightmaps.
+     * Lightmaps are cached by the manager and reused by later scenes with the same objects and baked lights.
+     * @param texels The width in texels of the lightmap area given to each pair of triangles.
+     */
+    void bake_lightmaps(SceneManager &manager, uint32_t texels = default_lightmap_texels);
+
 private:
+    static constexpr uint32_t bundle_magic = 0x42545352; // "RSTB"
+    static constexpr uint32_t bundle_version = 10;
+
+    void read_config(std::istream &config, SceneManager &manager);
+    void read_bundle(const std::string &file_name);
+
+    // Moves the camera and objects to their keyframed transforms, returning whether any object moved
+    bool animate(float time);
+
     uint32_t width, height;
     float fov;
+    Image::Format framebuffer_format = Image::Format::RGBA8;
 
     Camera camera;
     LightCollection lights;
+
+    float frame_rate = 24.0f;
+    uint32_t frame_count = 1;
     std::vector<std::shared_ptr<Object>> objects;
+
+    // Objects reached by more lights than this shade a random subset of this many lights per pixel, or all lights if zero
+    uint32_t light_samples = 0;
+
+    // Whether distant lights are collapsed into a spherical harmonics approximation for each object
+    bool approximate_distant_lights = false;
+
+    // Stores the world space bounds of the objects
+    BVH hierarchy;
 };
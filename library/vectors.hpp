@@ -51,6 +51,9 @@ struct Vec3
      */
     Vec3(float x, float y, float z) : x(x), y(y), z(z) {}
 
+    // The copies below only copy the fields, so bundles can store this as bytes
+    using plain_data = void;
+
     /**
      * Copy constructor.
      */
@@ -144,6 +147,9 @@ struct Vec4
      */
     Vec4(const Color &color) : x(color.r), y(color.g), z(color.b), w(0) {}
 
+    // The copies below only copy the fields, so bundles can store this as bytes
+    using plain_data = void;
+
     /**
      * Copy constructor.
      * Constructs a copy of the given vector.
@@ -31,8 +31,6 @@ Matrix4 screen(uint32_t width, uint32_t height)
 
 int main(int argc, char *argv[])
 {
-    stbi_flip_vertically_on_write(1);
-
     if (argc < 2)
     {
         std::cerr << "Error: Must provide a scene config" << "\n";
@@ -44,6 +42,7 @@ int main(int argc, char *argv[])
     Scene scene(config, manager);
 
     Image image(scene.get_width(), scene.get_height());
+    image.set_bottom_up(true);
     DepthBuffer depth(scene.get_width(), scene.get_height());
 
     Matrix4 m_projection = projection(scene.get_fov(), scene.get_aspect_ratio(), 1, 100);
@@ -51,7 +50,7 @@ int main(int argc, char *argv[])
 
     for (const auto &object : scene.get_objects())
     {
-        const Mesh &mesh = object->mesh;
+        const Mesh &mesh = *object->mesh;
 
         //TODO... Define the model matrix
         Matrix4 m_model = Matrix4::Identity;
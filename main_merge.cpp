@@ -0,0 +1,64 @@
+/* This file is part of the Michigan Computer Graphics rasterization workshop.
+ * Copyright (C) 2025  Aidan Rhys Donley
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "library/library.hpp"
+
+#include <string>
+#include <iostream>
+
+/**
+ * Stitches regions rendered separately with `--region` back into one image.
+ * Each part is placed at its offset in pixels from the top left, the same corner given to `--region`.
+ * The 8-bit pixels of each part are copied exactly, without converting them.
+ */
+int main(int argc, char *argv[])
+{
+    if (argc < 4 || (argc - 4) % 3 != 0)
+    {
+        std::cerr << "Error: Usage is " << argv[0] << " <output image> <width> <height> [<part image> <x> <y>]..." << "\n";
+        return 1;
+    }
+
+    try
+    {
+        std::string output = argv[1];
+        Image merged(std::stoul(argv[2]), std::stoul(argv[3]), Image::Format::RGBA8);
+
+        for (int i = 4; i + 2 < argc; i += 3)
+        {
+            Image part;
+            part.load_file(argv[i], Image::Format::RGBA8);
+
+            uint32_t x = std::stoul(argv[i + 1]), y = std::stoul(argv[i + 2]);
+            if (x + part.get_width() > merged.get_width() || y + part.get_height() > merged.get_height())
+                throw std::runtime_error(std::string(argv[i]) + " does not fit inside of the output");
+            merged.paste(part, x, y);
+        }
+
+        // Parts are loaded top row first, so the output is written without flipping
+        merged.write_file(output);
+
+        std::cout << "Merged " << (argc - 4) / 3 << " parts into " << output << "\n";
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
+
+    return 0;
+}
@@ -23,112 +23,426 @@
 
 #include <string>
 #include <iostream>
+#include <memory>
+#include <filesystem>
+#include <sstream>
+#include <iterator>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdint>
 
-int main(int argc, char *argv[])
+// Inserts the frame number before the extension, so "output.png" becomes "output_0007.png"
+static std::string get_frame_path(const std::string &output, uint32_t frame)
 {
-    stbi_flip_vertically_on_write(1);
+    char number[16];
+    std::snprintf(number, sizeof(number), "_%04u", frame);
 
-    if (argc < 2)
+    // A dot before the last slash belongs to a directory name
+    size_t dot = output.find_last_of('.');
+    size_t slash = output.find_last_of('/');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+        return output + number;
+    return output.substr(0, dot) + number + output.substr(dot);
+}
+
+// Returns whether frames are streamed into a single video instead of written as separate images
+static bool is_video(const std::string &output)
+{
+    return output == "-" || output.ends_with(".y4m") || std::filesystem::is_fifo(output);
+}
+
+// Renders a range of frames of the scene's animation, keeping the assets loaded between frames.
+// The vertex stage of each frame runs on this thread while the previous frame is rasterized and then encoded in the background.
+static void render_frames(Scene &scene, uint32_t first, uint32_t last, const std::string &output, const PNGSettings &png, std::ostream &log)
+{
+    // Video frames go straight to the encoder reading the stream, with no compression or files in between
+    std::unique_ptr<Y4MWriter> video;
+    if (is_video(output))
+        video = std::make_unique<Y4MWriter>(output, scene.get_width(), scene.get_height(), scene.get_frame_rate());
+
+    FrameWriter writer;
+    DepthBuffer depth(scene.get_width(), scene.get_height());
+
+    // Declared last so any frame still being drawn finishes before the buffers it uses are destroyed
+    ThreadPool rasterizer(1);
+    std::future<void> drawing;
+
+    Timer timer;
+
+    for (uint32_t frame = first; frame <= last; ++frame)
     {
-        std::cerr << "Error: Must provide a scene config" << "\n";
-        return 1;
+        scene.set_time(frame / scene.get_frame_rate());
+
+        View view(scene);
+        auto prepared = std::make_shared<PreparedFrame>(prepare_objects(view, scene.get_visible_objects(view.frustum, view.eye)));
+
+        // Only one frame is rasterized at a time since they share the depth buffer
+        if (drawing.valid())
+            drawing.get();
+
+        drawing = rasterizer.submit([&, prepared, frame]()
+                                    {
+                                        Image image(scene.get_width(), scene.get_height(), scene.get_framebuffer_format());
+                                        image.set_bottom_up(true);
+                                        depth.clear();
+                                        draw_prepared(image, depth, *prepared);
+                                        if (video)
+                                            writer.write(std::move(image), *video);
+                                        else
+                                            writer.write(std::move(image), get_frame_path(output, frame), png); });
     }
-    std::string config = argv[1];
 
-    SceneManager manager;
-    Scene scene(config, manager);
+    if (drawing.valid())
+        drawing.get();
+    writer.wait();
 
-    Image image(scene.get_width(), scene.get_height());
-    DepthBuffer depth(scene.get_width(), scene.get_height());
+    log << last - first + 1 << " frames in " << timer.elapsed() << " milliseconds\n";
+}
 
-    const Camera &camera = scene.get_camera();
-    Matrix4 m_view = quick_matrix_inverse(translate(camera.position) * rotate(camera.rotation));
+// Parses a whole argument as an integer within a range, throwing std::invalid_argument otherwise
+static int64_t parse_integer(const std::string &value, int64_t low, int64_t high)
+{
+    size_t end = 0;
+    int64_t number = std::stoll(value, &end);
+    if (end != value.size() || number < low || number > high)
+        throw std::invalid_argument(value);
+    return number;
+}
 
-    Matrix4 m_projection = perspective_projection(scene.get_fov(), scene.get_aspect_ratio(), 1, 100);
-    Matrix4 m_screen = screen_space(scene.get_width(), scene.get_height());
+// Returns the number of values that follow an option, or zero if the option is unknown
+static size_t get_value_count(const std::string &option)
+{
+    if (option == "--region")
+        return 4;
+    if (option == "--bundle" || option == "--output" || option == "--depth" || option == "--compression" ||
+        option == "--filter" || option == "--frames" || option == "--strip-rows")
+        return 1;
+    return 0;
+}
 
-    Timer timer;
+// Color and depth buffers kept between renders, reused while the size and format stay the same
+struct Framebuffers
+{
+    std::shared_ptr<Image> image;
+    std::shared_ptr<DepthBuffer> depth;
+};
 
-    for (const auto &object : scene.get_objects())
+static void prepare_framebuffers(Framebuffers &buffers, uint32_t width, uint32_t height, Image::Format format)
+{
+    if (buffers.image && buffers.image->get_width() == width && buffers.image->get_height() == height &&
+        buffers.image->get_format() == format)
     {
-        const Mesh &mesh = object->mesh;
+        buffers.image->clear();
+        buffers.depth->clear();
+        return;
+    }
 
-        // Define the model matrix
-        Matrix4 m_model = translate(object->position) * rotate(object->rotation) * scale(object->scale);
+    buffers.image = std::make_shared<Image>(width, height, format);
+    buffers.image->set_bottom_up(true);
+    buffers.depth = std::make_shared<DepthBuffer>(width, height);
+}
 
-        VertexBuffer vertices{mesh.vertex_size()};
+// Renders a scene given by a config followed by the command line options.
+// A config of "-" reads the YAML from the input stream instead of a file. Timings are printed to the log.
+static int render(const std::vector<std::string> &args, std::istream &input, SceneManager &manager,
+                  Framebuffers &framebuffers, std::ostream &log)
+{
+    const std::string &config = args[0];
 
-        // Transform all vertices in the mesh to world space and then to clip space
-        for (size_t i = 0; i < mesh.vertex_size(); ++i)
+    // The depth buffer is only saved when a path is given
+    std::string bundle, output = "output.png", depth, frames;
+    PNGSettings png;
+    uint32_t strip_rows = 0;
+
+    // The part of the frame to render, in pixels from the top left of the output
+    bool has_region = false;
+    uint32_t x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+
+    for (size_t i = 1; i < args.size(); i += 2)
+    {
+        const std::string &option = args[i];
+        size_t values = get_value_count(option);
+        if (values == 0)
+        {
+            std::cerr << "Error: Unknown option " << option << "\n";
+            return 1;
+        }
+        if (i + values >= args.size())
         {
-            vertices[i].world_coordinates   = m_model * mesh.get_vertex(i);
-            vertices[i].world_normals       = m_model * mesh.get_normal(i);
-            vertices[i].clip_coordinates    = m_projection * m_view * vertices[i].world_coordinates;
-            vertices[i].texture_coordinates = mesh.get_texture(i);
+            std::cerr << "Error: Missing value for " << option << "\n";
+            return 1;
         }
 
-        std::vector<Triplet> triangles;
+        // std::stoll throws std::out_of_range as well, so both are caught as logic errors
+        try
+        {
+            if (option == "--bundle")
+                bundle = args[i + 1];
+            else if (option == "--output")
+                output = args[i + 1];
+            else if (option == "--depth")
+                depth = args[i + 1];
+            else if (option == "--compression")
+                png.level = parse_integer(args[i + 1], 1, 9);
+            else if (option == "--filter")
+                png.filter = parse_integer(args[i + 1], -1, 4);
+            else if (option == "--frames")
+                frames = args[i + 1];
+            else if (option == "--strip-rows")
+                strip_rows = parse_integer(args[i + 1], 1, UINT32_MAX);
+            else if (option == "--region")
+            {
+                has_region = true;
+                x0 = parse_integer(args[i + 1], 0, UINT32_MAX);
+                y0 = parse_integer(args[i + 2], 0, UINT32_MAX);
+                x1 = parse_integer(args[i + 3], 0, UINT32_MAX);
+                y1 = parse_integer(args[i + 4], 0, UINT32_MAX);
+                i += 3;
+            }
+        }
+        catch (const std::logic_error &)
+        {
+            std::cerr << "Error: Invalid value for " << option << "\n";
+            return 1;
+        }
+    }
+
+    // Regions and depth are only drawn for single frames rendered in one piece
+    if ((has_region || !depth.empty()) && (strip_rows > 0 || !frames.empty() || is_video(output)))
+    {
+        std::cerr << "Error: --region and --depth cannot be combined with --strip-rows, --frames or a video output\n";
+        return 1;
+    }
 
-        // Loop through all triangles in the mesh
-        for (size_t i = 0; i < mesh.size(); ++i)
+    if (config != "-" && !std::filesystem::is_regular_file(config))
+    {
+        std::cerr << "Error: Cannot open scene config " << config << "\n";
+        return 1;
+    }
+
+    Scene scene = config == "-" ? Scene(input, manager) : Scene(config, manager);
+
+    // Save the scene and all of its assets so later renders can load it faster
+    if (!bundle.empty())
+    {
+        scene.write_bundle(bundle);
+        return 0;
+    }
+
+    // Render a range of frames given as "first-last", a single frame, or "all" of the animation.
+    // Videos hold the whole animation unless a range is given.
+    if (frames.empty() && is_video(output))
+        frames = "all";
+    if (!frames.empty())
+    {
+        uint32_t first = 0, last = scene.get_frame_count() - 1;
+        bool valid = true;
+        if (frames != "all")
+        {
+            size_t dash = frames.find('-');
+            try
+            {
+                first = parse_integer(frames.substr(0, dash), 0, UINT32_MAX);
+                last = dash == std::string::npos ? first : parse_integer(frames.substr(dash + 1), 0, UINT32_MAX);
+            }
+            catch (const std::logic_error &)
+            {
+                valid = false;
+            }
+        }
+        if (!valid || first > last)
         {
-            Triplet triangle = mesh[i];
-            std::vector<uint32_t> indices{triangle.indices, triangle.indices + 3};
+            std::cerr << "Error: Invalid frame range " << frames << "\n";
+            return 1;
+        }
 
-            // Clip triangles such that they are bounded within [-w, w] on all axes
-            vertices.sutherland_hodgman_clip(indices);
+        try
+        {
+            // Standard output may be carrying the video
+            render_frames(scene, first, last, output, png, output == "-" ? std::cerr : log);
+        }
+        catch (const std::exception &error)
+        {
+            std::cerr << "Error: " << error.what() << "\n";
+            return 1;
+        }
+        return 0;
+    }
 
-            // Reform triangles using fan triangulation
-            for (size_t j = 2; j < indices.size(); ++j)
-                triangles.emplace_back(indices[0], indices[j - 1], indices[j]);
+    // Very large images are rendered and saved a strip of rows at a time, so the whole image is never in memory
+    if (strip_rows > 0)
+    {
+        if (!output.ends_with(".png"))
+        {
+            std::cerr << "Error: Rendering in strips requires a PNG output" << "\n";
+            return 1;
         }
 
-        // Transform from clip space to screen space
-        for (size_t i = 0; i < vertices.size(); ++i)
+        try
         {
-            Vec4 &clip = vertices[i].clip_coordinates;
+            Timer timer;
 
-            // Scale by the depth
-            float temp = clip.w;
-            if (temp != 0) {
-                temp = 1.0f / temp;
-                clip *= temp;
-            }
+            PNGWriter writer(output, scene.get_width(), scene.get_height(), png);
 
-            vertices[i].screen_coordinates = m_screen * clip;
+            // Files are written from the top down, which is the last strip since the output is flipped
+            draw_strips(scene, strip_rows, true, [&](const Image &strip, uint32_t)
+                        { strip.write_rows(writer); });
+            writer.finish();
 
-            clip.w = temp; // store the w value for later
+            log << timer.elapsed() << " milliseconds\n";
         }
+        catch (const std::exception &error)
+        {
+            std::cerr << "Error: " << error.what() << "\n";
+            return 1;
+        }
+        return 0;
+    }
+
+    if (!has_region)
+    {
+        x1 = scene.get_width();
+        y1 = scene.get_height();
+    }
+    else if (x0 >= x1 || y0 >= y1 || x1 > scene.get_width() || y1 > scene.get_height())
+    {
+        std::cerr << "Error: Invalid region " << x0 << " " << y0 << " " << x1 << " " << y1 << "\n";
+        return 1;
+    }
+
+    prepare_framebuffers(framebuffers, x1 - x0, y1 - y0, scene.get_framebuffer_format());
+
+    // Image rows start from the bottom since the output is flipped
+    View view = has_region ? View(scene, Scissor{x0, scene.get_height() - y1, x1, scene.get_height() - y0}) : View(scene);
+
+    Timer timer;
 
-        std::vector<Triplet> drawn_triangles;
+    // Walk the object hierarchy from front to back, skipping objects outside of the view
+    draw_objects(*framebuffers.image, *framebuffers.depth, view, scene.get_visible_objects(view.frustum, view.eye));
 
-        for (size_t i = 0; i < triangles.size(); ++i)
+    log << timer.elapsed() << " milliseconds\n";
+
+    // Encoding happens in the background, the writer finishes before the buffers are reused
+    FrameWriter writer;
+    writer.write(framebuffers.image, output, png);
+    if (!depth.empty())
+        writer.write(framebuffers.depth, depth);
+
+    try
+    {
+        writer.wait();
+    }
+    catch (const std::exception &error)
+    {
+        std::cerr << "Error: " << error.what() << "\n";
+        return 1;
+    }
+
+    return 0;
+}
+
+// Renders requests read from standard input, one per line, keeping the asset cache and framebuffers between them.
+// Each line holds a config followed by the same options as the command line. A config of "-" is followed
+// by the lines of an inline YAML scene, ending with a "..." line. Every request is answered with a line
+// saying "ok" or "error" on standard output, while timings and error messages go to standard error.
+static int serve(size_t memory_budget)
+{
+    SceneManager manager(memory_budget);
+    Framebuffers framebuffers;
+
+    std::string line;
+    while (std::getline(std::cin, line))
+    {
+        std::istringstream words(line);
+        std::vector<std::string> args{std::istream_iterator<std::string>(words), std::istream_iterator<std::string>()};
+        if (args.empty())
+            continue;
+
+        std::istringstream inline_config;
+        if (args[0] == "-")
         {
-            Triplet triangle = triangles[i];
+            std::string yaml;
+            while (std::getline(std::cin, line) && line != "...")
+                yaml += line + "\n";
+            inline_config.str(yaml);
+        }
 
-            // Backface culling
-            Vec4 ab = vertices[triangle[1]].clip_coordinates - vertices[triangle[0]].clip_coordinates;
-            Vec4 ac = vertices[triangle[2]].clip_coordinates - vertices[triangle[0]].clip_coordinates;
+        int result = 1;
 
-            // Ignore triangles that are ordered incorrectly
-            float orientation = ab.x * ac.y - ac.x * ab.y;
-            if (orientation > 0.0f)
-                drawn_triangles.emplace_back(triangle);
+        // Standard output carries the replies, so it cannot also carry a video
+        auto output = std::find(args.begin(), args.end(), "--output");
+        if (output != args.end() && output + 1 != args.end() && output[1] == "-")
+        {
+            std::cerr << "Error: Cannot stream video to standard output while serving" << "\n";
+        }
+        else
+        {
+            // A bad request should not stop the server from answering the next one
+            try
+            {
+                result = render(args, inline_config, manager, framebuffers, std::cerr);
+            }
+            catch (const std::exception &error)
+            {
+                std::cerr << "Error: " << error.what() << "\n";
+            }
         }
-        
-        // Calculate the depth of each triangle
-        for (auto &triangle : drawn_triangles)
-            iterate_depth(depth, vertices[triangle[0]].screen_coordinates, vertices[triangle[1]].screen_coordinates, vertices[triangle[2]].screen_coordinates);
 
-        // Draw each triangle
-        for (auto &triangle : drawn_triangles)
-            draw_barycentric(image, depth, camera, m_model, scene.get_lights(), object->material, triangle, vertices);
+        // Assets stay loaded for later requests as long as they fit in the budget
+        manager.trim();
+
+        std::cout << (result == 0 ? "ok" : "error") << std::endl;
     }
 
-    std::cout << timer.elapsed() << " milliseconds\n";
+    return 0;
+}
 
-    image.write_file("output.png");
-    depth.get_image().write_file("depth.png");
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        std::cerr << "Error: Must provide a scene config" << "\n";
+        return 1;
+    }
 
-    return 0;
+    if (std::string(argv[1]) == "--serve")
+    {
+        size_t memory_budget = SceneManager::unlimited;
+        if (argc == 4 && std::string(argv[2]) == "--memory-budget")
+        {
+            // The budget is given in megabytes, so larger values would overflow once converted to bytes
+            try
+            {
+                memory_budget = static_cast<size_t>(parse_integer(argv[3], 0, SceneManager::unlimited >> 20)) << 20;
+            }
+            catch (const std::logic_error &)
+            {
+                std::cerr << "Error: Invalid value for --memory-budget" << "\n";
+                return 1;
+            }
+        }
+        else if (argc == 3 && std::string(argv[2]) == "--memory-budget")
+        {
+            std::cerr << "Error: Missing value for --memory-budget" << "\n";
+            return 1;
+        }
+        else if (argc != 2)
+        {
+            std::cerr << "Error: Unknown option " << argv[2] << "\n";
+            return 1;
+        }
+        return serve(memory_budget);
+    }
+
+    SceneManager manager;
+    Framebuffers framebuffers;
+    try
+    {
+        return render(std::vector<std::string>(argv + 1, argv + argc), std::cin, manager, framebuffers, std::cout);
+    }
+    catch (const std::exception &error)
+    {
+        std::cerr << "Error: " << error.what() << "\n";
+        return 1;
+    }
 }
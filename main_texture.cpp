@@ -0,0 +1,55 @@
+/* This file is part of the Michigan Computer Graphics rasterization workshop.
+ * Copyright (C) 2025  Aidan Rhys Donley
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "library/library.hpp"
+
+#include <string>
+#include <iostream>
+
+/**
+ * Converts an image into a texture container with all of its mip levels baked in,
+ * so the renderer can load it without decoding or converting any pixels.
+ */
+int main(int argc, char *argv[])
+{
+    if (argc < 3)
+    {
+        std::cerr << "Error: Usage is " << argv[0] << " <input image> <output texture> [--normal]" << "\n";
+        return 1;
+    }
+
+    std::string input = argv[1];
+    std::string output = argv[2];
+    bool normal_map = argc >= 4 && std::string(argv[3]) == "--normal";
+
+    try
+    {
+        Image image(input);
+        image.generate_mips(normal_map);
+        image.write_container(output);
+
+        std::cout << "Wrote " << image.get_width() << "x" << image.get_height() << " texture with "
+                  << image.mip_size() << " mip levels to " << output << "\n";
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
+
+    return 0;
+}